@@ -0,0 +1,91 @@
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Log-linear histogram of latencies in microseconds. Every power of two is
+// split into 32 linear buckets, so values are kept with about 3% relative
+// error in a fixed amount of memory.
+class LatencyHistogram {
+ public:
+  LatencyHistogram()
+      : counts_(BucketIndex(UINT64_MAX) + 1, 0),
+        count_(0),
+        sum_(0),
+        max_(0) {}
+
+  void Record(uint64_t us) {
+    counts_[BucketIndex(us)]++;
+    count_++;
+    sum_ += us;
+    max_ = std::max(max_, us);
+  }
+
+  void Merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < counts_.size(); i++) {
+      counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  // Returns the upper bound of the bucket holding the |q|-quantile, 0 <= q
+  // <= 1.
+  uint64_t Percentile(double q) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * (count_ - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(BucketUpperBound(i), max_);
+      }
+    }
+    return max_;
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+  double mean() const {
+    return count_ == 0 ? 0 : static_cast<double>(sum_) / count_;
+  }
+
+ private:
+  static const int kSubBucketBits = 6;
+  static const uint64_t kSubBuckets = 1 << kSubBucketBits;
+
+  // Values below kSubBuckets get a bucket each. A larger value v is put in
+  // the bucket covering [m << e, (m + 1) << e) where m = v >> e is its top
+  // kSubBucketBits bits.
+  static size_t BucketIndex(uint64_t v) {
+    if (v < kSubBuckets) {
+      return static_cast<size_t>(v);
+    }
+    int e = 63 - __builtin_clzll(v) - (kSubBucketBits - 1);
+    uint64_t m = v >> e;  // in [kSubBuckets / 2, kSubBuckets)
+    return static_cast<size_t>(kSubBuckets + (e - 1) * (kSubBuckets / 2) +
+                               (m - kSubBuckets / 2));
+  }
+
+  static uint64_t BucketUpperBound(size_t index) {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    uint64_t i = index - kSubBuckets;
+    int e = static_cast<int>(i / (kSubBuckets / 2)) + 1;
+    uint64_t m = i % (kSubBuckets / 2) + kSubBuckets / 2;
+    return ((m + 1) << e) - 1;
+  }
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+#endif  // LATENCY_HISTOGRAM_H_
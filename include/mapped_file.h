@@ -0,0 +1,89 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+// Read-only mapping of a whole file.
+//
+// Pages are only read in when touched, so files larger than memory can be
+// streamed through; Release() gives the pages of a processed range back so
+// that the resident size stays bounded too.
+class MappedFile {
+ public:
+  MappedFile() : data_(nullptr), size_(0) {}
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+  }
+
+  // |sequential| tells the kernel to read ahead aggressively.
+  bool Open(const std::string &path, bool sequential) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return Fail("Failed to open " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      Fail("Failed to stat " + path);
+      close(fd);
+      return false;
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        Fail("Failed to map " + path);
+        close(fd);
+        size_ = 0;
+        return false;
+      }
+      data_ = static_cast<char *>(p);
+      if (sequential) {
+        madvise(data_, size_, MADV_SEQUENTIAL);
+      }
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    return true;
+  }
+
+  // Drops the whole pages within [offset, offset + size) from memory. They
+  // are read in again if touched.
+  void Release(size_t offset, size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = (offset + page - 1) / page * page;
+    size_t end = (offset + size) / page * page;
+    if (begin < end) {
+      madvise(data_ + begin, end - begin, MADV_DONTNEED);
+    }
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  const std::string &error() const { return error_; }
+
+ private:
+  bool Fail(const std::string &error) {
+    error_ = error + ": " + std::strerror(errno);
+    return false;
+  }
+
+  char *data_;
+  size_t size_;
+  std::string error_;
+};
+
+#endif  // MAPPED_FILE_H_
@@ -5,11 +5,18 @@
 #include <memory>
 
 #include "curl/curl.h"
+#include "curl_response_sink.h"
 
 namespace curl {
 
-size_t WriteCallback(char* ptr, size_t size, size_t nmemb, void* userdata) {
-  std::cout.write(ptr, size * nmemb);
+// Hands the chunk to the ResponseSink in |userdata|, or drops it when no sink
+// is set.
+inline size_t WriteCallback(char* ptr, size_t size, size_t nmemb,
+                            void* userdata) {
+  auto sink = static_cast<ResponseSink*>(userdata);
+  if (sink != nullptr && !sink->Write(ptr, size * nmemb)) {
+    return 0;
+  }
   return size * nmemb;
 }
 
@@ -22,9 +29,8 @@ class EasyHandle {
       failed_ = true;
       return;
     }
-    curl_easy_setopt(handle_.get(), CURLOPT_URL, url.c_str());
-    curl_easy_setopt(handle_.get(), CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(handle_.get(), CURLOPT_WRITEDATA, this);
+    SetDefaultOptions();
+    SetUrl(url);
   }
 
   EasyHandle(EasyHandle&& other) noexcept
@@ -36,6 +42,7 @@ class EasyHandle {
     if (this != &other) {
       failed_ = other.failed_;
       handle_ = std::move(other.handle_);
+      sink_ = std::move(other.sink_);
     }
     return *this;
   }
@@ -45,6 +52,42 @@ class EasyHandle {
     handle_.reset();
   }
 
+  // Clears every option set on the handle and drops the sink. Live
+  // connections, the DNS cache and the TLS session cache are kept, so a reset
+  // handle is cheaper to reuse than a new one.
+  void Reset() {
+    // curl_easy_reset() keeps CURLOPT_SHARE, which would tie a pooled handle
+    // to a share it may outlive.
+    curl_easy_setopt(handle_.get(), CURLOPT_SHARE, nullptr);
+    curl_easy_reset(handle_.get());
+    sink_.reset();
+    SetDefaultOptions();
+  }
+
+  void SetUrl(const std::string& url) {
+    curl_easy_setopt(handle_.get(), CURLOPT_URL, url.c_str());
+  }
+
+  // The body is discarded until a sink is set. The sink lives on the heap, so
+  // it stays put when the handle is moved.
+  void SetSink(std::unique_ptr<ResponseSink> sink) {
+    sink_ = std::move(sink);
+    curl_easy_setopt(handle_.get(), CURLOPT_WRITEDATA, sink_.get());
+  }
+
+  std::unique_ptr<ResponseSink> TakeSink() {
+    curl_easy_setopt(handle_.get(), CURLOPT_WRITEDATA, nullptr);
+    return std::move(sink_);
+  }
+
+  ResponseSink* sink() const { return sink_.get(); }
+
+  // Preferred size of the chunks passed to the sink. Larger chunks mean fewer
+  // calls on big downloads.
+  void SetBufferSize(long size) {
+    curl_easy_setopt(handle_.get(), CURLOPT_BUFFERSIZE, size);
+  }
+
   bool Perform() {
     auto res = curl_easy_perform(handle_.get());
     return res == CURLE_OK;
@@ -56,8 +99,14 @@ class EasyHandle {
   CURL* raw_handle() const { return handle_.get(); }
 
  private:
+  void SetDefaultOptions() {
+    curl_easy_setopt(handle_.get(), CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(handle_.get(), CURLOPT_WRITEDATA, sink_.get());
+  }
+
   bool failed_;
   std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> handle_;
+  std::unique_ptr<ResponseSink> sink_;
 };
 
 }  // namespace curl
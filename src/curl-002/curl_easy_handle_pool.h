@@ -0,0 +1,57 @@
+#ifndef CURL_EASY_HANDLE_POOL_H_
+#define CURL_EASY_HANDLE_POOL_H_
+
+#include <string>
+#include <vector>
+
+#include "curl/curl.h"
+#include "curl_easy_handle.h"
+
+namespace curl {
+
+// Keeps finished EasyHandles around so that new requests can reuse their
+// connections, DNS cache and TLS sessions instead of starting from scratch.
+class EasyHandlePool {
+ public:
+  explicit EasyHandlePool(size_t capacity = 64) : capacity_(capacity) {}
+
+  // Returns a pooled handle pointed at |url|, or a new one if the pool is
+  // empty.
+  EasyHandle Acquire(const std::string &url) {
+    if (handles_.empty()) {
+      return EasyHandle(url);
+    }
+    EasyHandle easy(std::move(handles_.back()));
+    handles_.pop_back();
+    easy.SetUrl(url);
+    return easy;
+  }
+
+  // Resets |easy| and keeps it for later reuse. The handle is simply freed
+  // when the pool is full.
+  void Release(EasyHandle &&easy) {
+    if (!easy || handles_.size() >= capacity_) {
+      return;
+    }
+    easy.Reset();
+    handles_.emplace_back(std::move(easy));
+  }
+
+  size_t size() const { return handles_.size(); }
+  size_t capacity() const { return capacity_; }
+
+  void set_capacity(size_t capacity) {
+    capacity_ = capacity;
+    if (handles_.size() > capacity_) {
+      handles_.erase(handles_.begin() + capacity_, handles_.end());
+    }
+  }
+
+ private:
+  size_t capacity_;
+  std::vector<EasyHandle> handles_;
+};
+
+}  // namespace curl
+
+#endif  // CURL_EASY_HANDLE_POOL_H_
@@ -0,0 +1,237 @@
+#ifndef CURL_FETCHER_H_
+#define CURL_FETCHER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "curl/curl.h"
+#include "curl_global_context.h"
+#include "curl_multi_handle.h"
+#include "curl_response_sink.h"
+#include "curl_share_handle.h"
+#include "mpsc_queue.h"
+#include "uv.h"
+
+namespace curl {
+
+// Runs transfers on a fixed set of worker threads, each with its own uv loop,
+// MultiHandle and ShareHandle. Requests are handed to the workers round-robin
+// through lock-free queues, and completions come back the same way to the
+// loop of the thread that owns the Fetcher, where OnDoneFunc is called.
+//
+// Fetch() must be called on the owner loop's thread. The owner loop is kept
+// alive only while transfers are in flight, so uv_run(UV_RUN_DEFAULT) returns
+// once every fetch has been reported. The destructor runs the owner loop to
+// close its handle, so it must not be called from a callback of that loop.
+class Fetcher {
+ public:
+  using OnDoneFunc = std::function<void(const TransferResult &result,
+                                        std::unique_ptr<ResponseSink> sink)>;
+
+  struct Config {
+    int num_threads;
+    MultiHandle::Config multi;
+  };
+
+  static Config DefaultConfig() {
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    return {n > 0 ? n : 1, MultiHandle::DefaultConfig()};
+  }
+
+  explicit Fetcher(uv_loop_t *loop) : Fetcher(loop, DefaultConfig()) {}
+
+  Fetcher(uv_loop_t *loop, const Config &config)
+      : failed_(!global_context_),
+        loop_(loop),
+        async_(new uv_async_t),
+        in_flight_(0),
+        next_worker_(0) {
+    uv_async_init(loop, async_, OnCompletionsReady);
+    async_->data = this;
+    uv_unref(reinterpret_cast<uv_handle_t *>(async_));
+    if (failed_) {
+      return;
+    }
+    for (int i = 0; i < config.num_threads; i++) {
+      workers_.emplace_back(new Worker(this, config.multi));
+    }
+  }
+
+  Fetcher(const Fetcher &) = delete;
+  Fetcher &operator=(const Fetcher &) = delete;
+
+  // Waits for the transfers already handed to the workers. Their completions
+  // are dropped.
+  ~Fetcher() {
+    workers_.clear();
+    uv_close(reinterpret_cast<uv_handle_t *>(async_), [](uv_handle_t *h) {
+      static_cast<Fetcher *>(h->data)->async_ = nullptr;
+      delete reinterpret_cast<uv_async_t *>(h);
+    });
+    // Only the loop runs close callbacks, and uv_run() does not block while
+    // a handle is closing.
+    while (async_ != nullptr) {
+      uv_run(loop_, UV_RUN_NOWAIT);
+    }
+  }
+
+  // |sink| may be null to discard the body. It is handed back to |on_done|.
+  bool Fetch(const std::string &url, std::unique_ptr<ResponseSink> sink,
+             const OnDoneFunc &on_done) {
+    if (workers_.empty()) {
+      return false;
+    }
+    if (in_flight_++ == 0) {
+      uv_ref(reinterpret_cast<uv_handle_t *>(async_));
+    }
+    Request req;
+    req.url = url;
+    req.sink = std::move(sink);
+    req.on_done = on_done;
+    workers_[next_worker_]->Submit(std::move(req));
+    next_worker_ = (next_worker_ + 1) % workers_.size();
+    return true;
+  }
+
+  size_t in_flight() const { return in_flight_; }
+  size_t num_threads() const { return workers_.size(); }
+
+  explicit operator bool() const { return !failed_; }
+  bool failed() const { return failed_; }
+
+ private:
+  struct Request {
+    std::string url;
+    std::unique_ptr<ResponseSink> sink;
+    OnDoneFunc on_done;
+  };
+
+  struct Completion {
+    TransferResult result;
+    std::unique_ptr<ResponseSink> sink;
+    OnDoneFunc on_done;
+  };
+
+  class Worker {
+   public:
+    Worker(Fetcher *fetcher, const MultiHandle::Config &config)
+        : fetcher_(fetcher),
+          config_(config),
+          multi_(nullptr),
+          stopping_(false) {
+      uv_loop_init(&loop_);
+      // Initialized before the thread starts, so Submit() may be called
+      // right away.
+      uv_async_init(&loop_, &async_, OnRequestsReady);
+      async_.data = this;
+      thread_ = std::thread([this]() { Run(); });
+    }
+
+    ~Worker() {
+      stopping_.store(true, std::memory_order_release);
+      uv_async_send(&async_);
+      thread_.join();
+    }
+
+    void Submit(Request &&req) {
+      requests_.Push(std::move(req));
+      uv_async_send(&async_);
+    }
+
+   private:
+    void Run() {
+      {
+        ShareHandle share;
+        MultiHandle::Config config = config_;
+        config.share = &share;
+        MultiHandle multi(&loop_, config);
+        multi_ = &multi;
+        uv_run(&loop_, UV_RUN_DEFAULT);
+        multi_ = nullptr;
+      }
+      uv_loop_close(&loop_);
+    }
+
+    static void OnRequestsReady(uv_async_t *async) {
+      auto self = static_cast<Worker *>(async->data);
+      Request req;
+      while (self->requests_.Pop(&req)) {
+        self->Start(std::move(req));
+      }
+      if (self->stopping_.load(std::memory_order_acquire)) {
+        // The loop returns once the transfers in flight are done.
+        uv_close(reinterpret_cast<uv_handle_t *>(&self->async_), nullptr);
+      }
+    }
+
+    void Start(Request &&req) {
+      EasyHandle easy = multi_->Acquire(req.url);
+      easy.SetSink(std::move(req.sink));
+      auto on_done = req.on_done;
+      Fetcher *fetcher = fetcher_;
+      bool added = multi_->Add(
+          std::move(easy),
+          [fetcher, on_done](EasyHandle &easy, const TransferResult &result) {
+            Completion c;
+            c.result = result;
+            c.sink = easy.TakeSink();
+            c.on_done = on_done;
+            fetcher->Complete(std::move(c));
+          });
+      if (!added) {
+        // Report it anyway, or the owner loop would wait for it forever.
+        Completion c;
+        c.result = TransferResult();
+        c.result.code = CURLE_FAILED_INIT;
+        c.sink = easy.TakeSink();
+        c.on_done = on_done;
+        fetcher_->Complete(std::move(c));
+      }
+    }
+
+    Fetcher *fetcher_;
+    MultiHandle::Config config_;
+    uv_loop_t loop_;
+    uv_async_t async_;
+    MultiHandle *multi_;
+    MpscQueue<Request> requests_;
+    std::atomic<bool> stopping_;
+    std::thread thread_;
+  };
+
+  // Called on worker threads.
+  void Complete(Completion &&c) {
+    completions_.Push(std::move(c));
+    uv_async_send(async_);
+  }
+
+  static void OnCompletionsReady(uv_async_t *async) {
+    auto self = static_cast<Fetcher *>(async->data);
+    Completion c;
+    while (self->completions_.Pop(&c)) {
+      if (--self->in_flight_ == 0) {
+        uv_unref(reinterpret_cast<uv_handle_t *>(self->async_));
+      }
+      if (c.on_done) {
+        c.on_done(c.result, std::move(c.sink));
+      }
+    }
+  }
+
+  GlobalContext global_context_;
+  bool failed_;
+  uv_loop_t *loop_;
+  uv_async_t *async_;
+  size_t in_flight_;
+  size_t next_worker_;
+  MpscQueue<Completion> completions_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+}  // namespace curl
+
+#endif  // CURL_FETCHER_H_
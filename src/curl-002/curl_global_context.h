@@ -2,29 +2,44 @@
 #define CURL_GLOBAL_CONTEXT_H_
 
 #include <iostream>
-#include <memory>
+#include <mutex>
 
 #include "curl/curl.h"
 #include "curl_easy_handle.h"
 
 namespace curl {
 
+// curl_global_init is not thread-safe and must run once before any handle is
+// created. Any number of GlobalContexts may exist on any threads; the first
+// one initializes libcurl, exactly once per process, and later ones only see
+// whether that worked.
+//
+// libcurl is never cleaned up. curl_global_cleanup is not thread-safe either,
+// and a count of live contexts would tear down and set up the TLS backend
+// again whenever it dropped to zero and rose again.
 class GlobalContext {
  public:
-  GlobalContext() : failed_(false) {
-    if (curl_global_init(CURL_GLOBAL_DEFAULT) != 0) {
-      std::cout << "curl_global_init failed" << std::endl;
-      failed_ = true;
-      return;
-    }
-  }
+  GlobalContext() : failed_(!Init()) {}
 
-  ~GlobalContext() { curl_global_cleanup(); }
+  GlobalContext(const GlobalContext &) = delete;
+  GlobalContext &operator=(const GlobalContext &) = delete;
 
   explicit operator bool() const { return !failed_; }
   bool failed() const { return failed_; }
 
  private:
+  static bool Init() {
+    static std::once_flag once;
+    static bool ok = false;
+    std::call_once(once, []() {
+      ok = curl_global_init(CURL_GLOBAL_DEFAULT) == 0;
+      if (!ok) {
+        std::cout << "curl_global_init failed" << std::endl;
+      }
+    });
+    return ok;
+  }
+
   bool failed_;
 };
 
@@ -1,38 +1,165 @@
 #ifndef CURL_MULTI_HANDLE_H_
 #define CURL_MULTI_HANDLE_H_
 
+#include <functional>
 #include <memory>
-#include <vector>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "curl/curl.h"
 #include "curl_easy_handle.h"
+#include "curl_easy_handle_pool.h"
+#include "curl_share_handle.h"
+#include "uv.h"
 
 namespace curl {
 
+// Outcome of a finished transfer. Times are in microseconds from the start of
+// the transfer, as reported by CURLINFO_*_TIME_T.
+struct TransferResult {
+  CURLcode code;
+  long response_code;
+  curl_off_t namelookup_time;
+  curl_off_t connect_time;
+  curl_off_t appconnect_time;
+  curl_off_t starttransfer_time;
+  curl_off_t total_time;
+  curl_off_t size_download;
+};
+
+// MultiHandle works in one of two modes.
+//
+// - Polling mode (default constructor): the caller drives transfers by
+//   calling Perform() and Wait() in a loop.
+// - Socket-action mode (constructed with a uv_loop_t): libcurl tells us which
+//   sockets to watch and when to wake up, and transfers progress from the
+//   uv loop only when a socket is ready or a timeout expires. Perform() and
+//   Wait() must not be used in this mode; just run the loop. The destructor
+//   runs the loop until its own uv handles are closed, so it must not be
+//   called from a callback of that loop.
+//
+// Finished transfers are removed from the multi handle, reported to their
+// OnDoneFunc and then returned to pool() for reuse by Acquire().
 class MultiHandle {
  public:
-  MultiHandle()
-      : failed_(false), handle_(curl_multi_init(), curl_multi_cleanup) {
+  using OnDoneFunc =
+      std::function<void(EasyHandle &easy, const TransferResult &result)>;
+
+  struct Config {
+    // 0 means no limit. Transfers over the limits wait in libcurl's queue
+    // until a connection is free.
+    long max_host_connections;
+    long max_total_connections;
+    // Runs HTTP/2 requests to the same host as streams on one connection.
+    // Off by default, since Add() then makes every handle ask for HTTP/2 over
+    // TLS and wait for a connection it can multiplex on, whatever the caller
+    // set.
+    bool multiplex;
+    long max_concurrent_streams;
+    // Optional DNS/TLS-session/connection cache applied to every added
+    // handle. Must outlive the MultiHandle.
+    ShareHandle *share;
+  };
+
+  static Config DefaultConfig() { return {0, 0, false, 100, nullptr}; }
+
+  MultiHandle() : MultiHandle(nullptr) {}
+
+  explicit MultiHandle(uv_loop_t *loop) : MultiHandle(loop, DefaultConfig()) {}
+
+  MultiHandle(uv_loop_t *loop, const Config &config)
+      : failed_(false),
+        config_(config),
+        loop_(loop),
+        timer_(nullptr),
+        running_(0),
+        closing_(0),
+        handle_(curl_multi_init(), curl_multi_cleanup) {
     if (!handle_) {
       failed_ = true;
       return;
     }
+    curl_multi_setopt(handle_.get(), CURLMOPT_MAX_HOST_CONNECTIONS,
+                      config_.max_host_connections);
+    curl_multi_setopt(handle_.get(), CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                      config_.max_total_connections);
+    long pipelining = config_.multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING;
+    curl_multi_setopt(handle_.get(), CURLMOPT_PIPELINING, pipelining);
+    curl_multi_setopt(handle_.get(), CURLMOPT_MAX_CONCURRENT_STREAMS,
+                      config_.max_concurrent_streams);
+    if (loop_ != nullptr) {
+      timer_ = new uv_timer_t;
+      uv_timer_init(loop_, timer_);
+      timer_->data = this;
+      curl_multi_setopt(handle_.get(), CURLMOPT_SOCKETFUNCTION, OnSocket);
+      curl_multi_setopt(handle_.get(), CURLMOPT_SOCKETDATA, this);
+      curl_multi_setopt(handle_.get(), CURLMOPT_TIMERFUNCTION, OnTimer);
+      curl_multi_setopt(handle_.get(), CURLMOPT_TIMERDATA, this);
+    }
   }
 
+  MultiHandle(const MultiHandle &) = delete;
+  MultiHandle &operator=(const MultiHandle &) = delete;
+
   ~MultiHandle() {
-    easy_handles_.clear();
+    for (const auto &kv : transfers_) {
+      curl_multi_remove_handle(handle_.get(), kv.first);
+    }
+    transfers_.clear();
     handle_.reset();
+    if (loop_ == nullptr) {
+      return;
+    }
+    // libcurl does not always report CURL_POLL_REMOVE on cleanup.
+    while (!sockets_.empty()) {
+      ClosePoll(*sockets_.begin());
+    }
+    // The timer does not exist if curl_multi_init() failed.
+    if (timer_ != nullptr) {
+      uv_timer_stop(timer_);
+      closing_++;
+      uv_close(reinterpret_cast<uv_handle_t *>(timer_), [](uv_handle_t *h) {
+        static_cast<MultiHandle *>(h->data)->closing_--;
+        delete reinterpret_cast<uv_timer_t *>(h);
+      });
+    }
+    // The handles are freed by their close callbacks, which only the loop
+    // runs. uv_run() does not block while handles are closing.
+    while (closing_ > 0) {
+      uv_run(loop_, UV_RUN_NOWAIT);
+    }
   }
 
-  void Add(EasyHandle &&easy) {
-    curl_multi_add_handle(handle_.get(), easy.raw_handle());
-    easy_handles_.emplace_back(std::move(easy));
+  // Returns an EasyHandle for |url|, recycled from a finished transfer when
+  // possible.
+  EasyHandle Acquire(const std::string &url) { return pool_.Acquire(url); }
+
+  // On failure |easy| is left untouched and |on_done| is not called.
+  bool Add(EasyHandle &&easy) { return Add(std::move(easy), nullptr); }
+
+  bool Add(EasyHandle &&easy, const OnDoneFunc &on_done) {
+    CURL *raw = easy.raw_handle();
+    if (config_.share != nullptr) {
+      curl_easy_setopt(raw, CURLOPT_SHARE, config_.share->raw_handle());
+    }
+    if (config_.multiplex) {
+      curl_easy_setopt(raw, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+      // Wait for a connection that can multiplex rather than opening another.
+      curl_easy_setopt(raw, CURLOPT_PIPEWAIT, 1L);
+    }
+    auto mc = curl_multi_add_handle(handle_.get(), raw);
+    if (mc != CURLM_OK) {
+      std::cout << "curl_multi_add_handle failed with " << mc << std::endl;
+      return false;
+    }
+    transfers_.emplace(raw, Transfer(std::move(easy), on_done));
+    return true;
   }
 
   int Perform() {
     int still_running;
-    std::cout << "handle: " << handle_.get() << std::endl;
     curl_multi_perform(handle_.get(), &still_running);
+    ProcessCompletions();
     return still_running;
   }
 
@@ -46,13 +173,181 @@ class MultiHandle {
     return numfds;
   }
 
+  // Number of transfers still in progress as of the last socket action.
+  // Only meaningful in socket-action mode.
+  int running() const { return running_; }
+
+  // Number of transfers added and not yet completed.
+  size_t size() const { return transfers_.size(); }
+
+  bool socket_action_mode() const { return loop_ != nullptr; }
+
+  EasyHandlePool &pool() { return pool_; }
+
   explicit operator bool() const { return !failed_; }
   bool failed() const { return failed_; }
 
  private:
+  struct Transfer {
+    Transfer(EasyHandle &&easy, const OnDoneFunc &on_done)
+        : easy(std::move(easy)), on_done(on_done) {}
+
+    EasyHandle easy;
+    OnDoneFunc on_done;
+  };
+
+  struct SocketContext {
+    uv_poll_t poll;
+    curl_socket_t sockfd;
+    MultiHandle *multi;
+  };
+
+  void ClosePoll(SocketContext *ctx) {
+    sockets_.erase(ctx);
+    uv_poll_stop(&ctx->poll);
+    closing_++;
+    uv_close(reinterpret_cast<uv_handle_t *>(&ctx->poll), [](uv_handle_t *h) {
+      auto ctx = static_cast<SocketContext *>(h->data);
+      ctx->multi->closing_--;
+      delete ctx;
+    });
+  }
+
+  void SocketAction(curl_socket_t sockfd, int ev_bitmask) {
+    auto mc = curl_multi_socket_action(handle_.get(), sockfd, ev_bitmask,
+                                       &running_);
+    if (mc != CURLM_OK) {
+      std::cout << "curl_multi_socket_action failed with " << mc << std::endl;
+    }
+    ProcessCompletions();
+  }
+
+  void ProcessCompletions() {
+    CURLMsg *msg;
+    int msgs_in_queue;
+    while ((msg = curl_multi_info_read(handle_.get(), &msgs_in_queue)) !=
+           nullptr) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      CURL *raw = msg->easy_handle;
+      TransferResult result = GetTransferResult(raw, msg->data.result);
+      curl_multi_remove_handle(handle_.get(), raw);
+
+      auto it = transfers_.find(raw);
+      if (it == transfers_.end()) {
+        continue;
+      }
+      // Take the transfer out first so that the callback may add new ones.
+      Transfer transfer(std::move(it->second));
+      transfers_.erase(it);
+      if (transfer.on_done) {
+        transfer.on_done(transfer.easy, result);
+      }
+      pool_.Release(std::move(transfer.easy));
+    }
+  }
+
+  static TransferResult GetTransferResult(CURL *raw, CURLcode code) {
+    TransferResult r = {};
+    r.code = code;
+    curl_easy_getinfo(raw, CURLINFO_RESPONSE_CODE, &r.response_code);
+    curl_easy_getinfo(raw, CURLINFO_NAMELOOKUP_TIME_T, &r.namelookup_time);
+    curl_easy_getinfo(raw, CURLINFO_CONNECT_TIME_T, &r.connect_time);
+    curl_easy_getinfo(raw, CURLINFO_APPCONNECT_TIME_T, &r.appconnect_time);
+    curl_easy_getinfo(raw, CURLINFO_STARTTRANSFER_TIME_T,
+                      &r.starttransfer_time);
+    curl_easy_getinfo(raw, CURLINFO_TOTAL_TIME_T, &r.total_time);
+    curl_easy_getinfo(raw, CURLINFO_SIZE_DOWNLOAD_T, &r.size_download);
+    return r;
+  }
+
+  // CURLMOPT_SOCKETFUNCTION
+  static int OnSocket(CURL *easy, curl_socket_t sockfd, int what, void *userp,
+                      void *socketp) {
+    auto self = static_cast<MultiHandle *>(userp);
+    auto ctx = static_cast<SocketContext *>(socketp);
+
+    if (what == CURL_POLL_REMOVE) {
+      if (ctx != nullptr) {
+        curl_multi_assign(self->handle_.get(), sockfd, nullptr);
+        self->ClosePoll(ctx);
+      }
+      return 0;
+    }
+
+    if (ctx == nullptr) {
+      ctx = new SocketContext;
+      ctx->sockfd = sockfd;
+      ctx->multi = self;
+      int r = uv_poll_init_socket(self->loop_, &ctx->poll, sockfd);
+      if (r != 0) {
+        // The handle was never initialized, so it is not closed either.
+        std::cout << "uv_poll_init_socket failed: " << uv_strerror(r)
+                  << std::endl;
+        delete ctx;
+        return -1;
+      }
+      ctx->poll.data = ctx;
+      curl_multi_assign(self->handle_.get(), sockfd, ctx);
+      self->sockets_.insert(ctx);
+    }
+
+    int events = 0;
+    if (what & CURL_POLL_IN) {
+      events |= UV_READABLE;
+    }
+    if (what & CURL_POLL_OUT) {
+      events |= UV_WRITABLE;
+    }
+    uv_poll_start(&ctx->poll, events, OnPoll);
+    return 0;
+  }
+
+  // CURLMOPT_TIMERFUNCTION
+  static int OnTimer(CURLM *multi, long timeout_ms, void *userp) {
+    auto self = static_cast<MultiHandle *>(userp);
+    if (timeout_ms < 0) {
+      uv_timer_stop(self->timer_);
+    } else {
+      // A zero timeout still goes through the loop, since libcurl must not be
+      // re-entered from this callback.
+      uv_timer_start(self->timer_, OnTimeout, timeout_ms, 0);
+    }
+    return 0;
+  }
+
+  static void OnTimeout(uv_timer_t *timer) {
+    auto self = static_cast<MultiHandle *>(timer->data);
+    self->SocketAction(CURL_SOCKET_TIMEOUT, 0);
+  }
+
+  static void OnPoll(uv_poll_t *poll, int status, int events) {
+    auto ctx = static_cast<SocketContext *>(poll->data);
+    int flags = 0;
+    if (status < 0) {
+      flags |= CURL_CSELECT_ERR;
+    }
+    if (events & UV_READABLE) {
+      flags |= CURL_CSELECT_IN;
+    }
+    if (events & UV_WRITABLE) {
+      flags |= CURL_CSELECT_OUT;
+    }
+    ctx->multi->SocketAction(ctx->sockfd, flags);
+  }
+
   bool failed_;
+  Config config_;
+  uv_loop_t *loop_;
+  uv_timer_t *timer_;
+  int running_;
+  // uv handles closed whose close callbacks have not run yet.
+  int closing_;
+  std::unordered_set<SocketContext *> sockets_;
   std::unique_ptr<CURLM, decltype(&curl_multi_cleanup)> handle_;
-  std::vector<EasyHandle> easy_handles_;
+  std::unordered_map<CURL *, Transfer> transfers_;
+  EasyHandlePool pool_;
 };
 
 }  // namespace curl
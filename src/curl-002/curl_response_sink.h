@@ -0,0 +1,212 @@
+#ifndef CURL_RESPONSE_SINK_H_
+#define CURL_RESPONSE_SINK_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace curl {
+
+// Destination of a response body. EasyHandle hands every chunk it receives
+// from libcurl to Write() as is, without buffering it anywhere else.
+class ResponseSink {
+ public:
+  virtual ~ResponseSink() {}
+
+  // Returns false to abort the transfer with CURLE_WRITE_ERROR.
+  virtual bool Write(const char *data, size_t size) = 0;
+};
+
+// Growable in-memory buffer made of blocks that are never reallocated, so
+// growing it does not copy the data received so far.
+class ArenaSink : public ResponseSink {
+ public:
+  explicit ArenaSink(size_t initial_block_size = 16 * 1024,
+                     size_t max_block_size = 1024 * 1024)
+      : next_block_size_(initial_block_size),
+        max_block_size_(max_block_size),
+        current_(0),
+        size_(0) {}
+
+  bool Write(const char *data, size_t size) override {
+    size_ += size;
+    while (size > 0) {
+      if (current_ == blocks_.size()) {
+        AddBlock(size);
+      }
+      Block &block = blocks_[current_];
+      size_t n = std::min(size, block.capacity - block.size);
+      std::memcpy(block.data.get() + block.size, data, n);
+      block.size += n;
+      data += n;
+      size -= n;
+      if (block.size == block.capacity) {
+        current_++;
+      }
+    }
+    return true;
+  }
+
+  // Calls fn(const char *data, size_t size) for every non-empty block in
+  // order.
+  template <class Fn>
+  void ForEachChunk(Fn fn) const {
+    for (const auto &block : blocks_) {
+      if (block.size > 0) {
+        fn(block.data.get(), block.size);
+      }
+    }
+  }
+
+  std::string ToString() const {
+    std::string str;
+    str.reserve(size_);
+    ForEachChunk([&str](const char *data, size_t size) {
+      str.append(data, size);
+    });
+    return str;
+  }
+
+  // Empties the buffer but keeps the blocks for the next response.
+  void Clear() {
+    for (auto &block : blocks_) {
+      block.size = 0;
+    }
+    current_ = 0;
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t capacity;
+    size_t size;
+  };
+
+  void AddBlock(size_t min_size) {
+    size_t capacity = std::max(next_block_size_, min_size);
+    next_block_size_ = std::min(next_block_size_ * 2, max_block_size_);
+    Block block = {std::unique_ptr<char[]>(new char[capacity]), capacity, 0};
+    blocks_.emplace_back(std::move(block));
+  }
+
+  size_t next_block_size_;
+  size_t max_block_size_;
+  size_t current_;
+  size_t size_;
+  std::vector<Block> blocks_;
+};
+
+// Writes into a buffer owned by the caller. The transfer fails once the body
+// does not fit.
+class FixedBufferSink : public ResponseSink {
+ public:
+  FixedBufferSink(char *buf, size_t capacity)
+      : buf_(buf), capacity_(capacity), size_(0), overflowed_(false) {}
+
+  bool Write(const char *data, size_t size) override {
+    if (size > capacity_ - size_) {
+      overflowed_ = true;
+      return false;
+    }
+    std::memcpy(buf_ + size_, data, size);
+    size_ += size;
+    return true;
+  }
+
+  const char *data() const { return buf_; }
+  size_t size() const { return size_; }
+  bool overflowed() const { return overflowed_; }
+
+ private:
+  char *buf_;
+  size_t capacity_;
+  size_t size_;
+  bool overflowed_;
+};
+
+// Passes every chunk straight to a callback. The pointer is only valid during
+// the call.
+class ChunkCallbackSink : public ResponseSink {
+ public:
+  using OnChunkFunc = std::function<bool(const char *data, size_t size)>;
+
+  explicit ChunkCallbackSink(const OnChunkFunc &on_chunk)
+      : on_chunk_(on_chunk) {}
+
+  bool Write(const char *data, size_t size) override {
+    return on_chunk_(data, size);
+  }
+
+ private:
+  OnChunkFunc on_chunk_;
+};
+
+// Writes the body to a file descriptor with pwrite(2), starting at a given
+// offset. Nothing is buffered in user space.
+class FileSink : public ResponseSink {
+ public:
+  // Does not take ownership of |fd|.
+  FileSink(int fd, off_t offset)
+      : fd_(fd), owns_fd_(false), offset_(offset), written_(0), errno_(0) {}
+
+  // Creates or truncates |path|.
+  explicit FileSink(const std::string &path)
+      : fd_(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+        owns_fd_(true),
+        offset_(0),
+        written_(0),
+        errno_(fd_ < 0 ? errno : 0) {}
+
+  FileSink(const FileSink &) = delete;
+  FileSink &operator=(const FileSink &) = delete;
+
+  ~FileSink() {
+    if (owns_fd_ && fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  bool Write(const char *data, size_t size) override {
+    while (size > 0) {
+      ssize_t n = pwrite(fd_, data, size, offset_ + written_);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        errno_ = errno;
+        return false;
+      }
+      data += n;
+      size -= n;
+      written_ += n;
+    }
+    return true;
+  }
+
+  explicit operator bool() const { return fd_ >= 0 && errno_ == 0; }
+
+  off_t written() const { return written_; }
+  // errno of the last failed open(2) or pwrite(2), or 0.
+  int error() const { return errno_; }
+
+ private:
+  int fd_;
+  bool owns_fd_;
+  off_t offset_;
+  off_t written_;
+  int errno_;
+};
+
+}  // namespace curl
+
+#endif  // CURL_RESPONSE_SINK_H_
@@ -0,0 +1,73 @@
+#ifndef CURL_SHARE_HANDLE_H_
+#define CURL_SHARE_HANDLE_H_
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "curl/curl.h"
+
+namespace curl {
+
+// Wraps a CURLSH so that EasyHandles can share the DNS cache, TLS sessions
+// and, within one thread, open connections.
+class ShareHandle {
+ public:
+  // With |thread_safe|, the share is protected by locks and may be used by
+  // handles running on different threads. Connections are then not shared,
+  // since libcurl does not support using one connection from two threads.
+  explicit ShareHandle(bool thread_safe = false)
+      : failed_(false), handle_(curl_share_init(), curl_share_cleanup) {
+    if (!handle_) {
+      std::cout << "curl_share_init failed" << std::endl;
+      failed_ = true;
+      return;
+    }
+    if (thread_safe) {
+      curl_share_setopt(handle_.get(), CURLSHOPT_LOCKFUNC, Lock);
+      curl_share_setopt(handle_.get(), CURLSHOPT_UNLOCKFUNC, Unlock);
+      curl_share_setopt(handle_.get(), CURLSHOPT_USERDATA, this);
+    }
+    Share(CURL_LOCK_DATA_DNS);
+    Share(CURL_LOCK_DATA_SSL_SESSION);
+    if (!thread_safe) {
+      Share(CURL_LOCK_DATA_CONNECT);
+    }
+  }
+
+  ShareHandle(const ShareHandle &) = delete;
+  ShareHandle &operator=(const ShareHandle &) = delete;
+
+  explicit operator bool() const { return !failed_; }
+  bool failed() const { return failed_; }
+
+  CURLSH *raw_handle() const { return handle_.get(); }
+
+ private:
+  void Share(curl_lock_data data) {
+    auto sc = curl_share_setopt(handle_.get(), CURLSHOPT_SHARE, data);
+    if (sc != CURLSHE_OK) {
+      std::cout << "curl_share_setopt failed with " << curl_share_strerror(sc)
+                << std::endl;
+      failed_ = true;
+    }
+  }
+
+  static void Lock(CURL *easy, curl_lock_data data, curl_lock_access access,
+                   void *userptr) {
+    static_cast<ShareHandle *>(userptr)->mutexes_[data].lock();
+  }
+
+  static void Unlock(CURL *easy, curl_lock_data data, void *userptr) {
+    static_cast<ShareHandle *>(userptr)->mutexes_[data].unlock();
+  }
+
+  bool failed_;
+  // Declared before handle_ since curl_share_cleanup may still lock.
+  std::mutex mutexes_[CURL_LOCK_DATA_LAST];
+  std::unique_ptr<CURLSH, decltype(&curl_share_cleanup)> handle_;
+};
+
+}  // namespace curl
+
+#endif  // CURL_SHARE_HANDLE_H_
@@ -4,6 +4,8 @@
 #include "curl_easy_handle.h"
 #include "curl_global_context.h"
 #include "curl_multi_handle.h"
+#include "curl_share_handle.h"
+#include "uv.h"
 
 class Application {
  public:
@@ -12,7 +14,19 @@ class Application {
   ~Application() {}
 
   bool Run() {
-    curl::MultiHandle multi_handle;
+    uv_loop_t *loop = uv_default_loop();
+
+    curl::ShareHandle share;
+    if (!share) {
+      std::cout << "curl::ShareHandle failed" << std::endl;
+      return false;
+    }
+
+    auto config = curl::MultiHandle::DefaultConfig();
+    config.max_host_connections = 6;
+    config.multiplex = true;
+    config.share = &share;
+    curl::MultiHandle multi_handle(loop, config);
     if (!multi_handle) {
       std::cout << "curl::MultiHandle failed" << std::endl;
       return false;
@@ -23,14 +37,46 @@ class Application {
       std::cout << "curl::EasyHandle failed" << std::endl;
       return false;
     }
+    e1.SetSink(std::unique_ptr<curl::ResponseSink>(new curl::ArenaSink()));
+    e2.SetSink(std::unique_ptr<curl::ResponseSink>(
+        new curl::ChunkCallbackSink([](const char *data, size_t size) {
+          std::cout.write(data, size);
+          return true;
+        })));
 
-    multi_handle.Add(std::move(e1));
-    multi_handle.Add(std::move(e2));
+    auto print_result = [](const char *name,
+                           const curl::TransferResult &result) {
+      std::cout << std::endl
+                << name << ": " << curl_easy_strerror(result.code)
+                << " (status: " << result.response_code
+                << ", total: " << result.total_time << "us)" << std::endl;
+    };
 
-    multi_handle.Perform();
-    while (multi_handle.Perform() > 0) {
-      multi_handle.Wait();
-    }
+    multi_handle.Add(std::move(e1), [&](curl::EasyHandle &easy,
+                                        const curl::TransferResult &result) {
+      print_result("google", result);
+      auto arena = static_cast<curl::ArenaSink *>(easy.sink());
+      std::cout << "google: " << arena->size() << " bytes buffered"
+                << std::endl;
+    });
+    multi_handle.Add(std::move(e2), [&](curl::EasyHandle &easy,
+                                        const curl::TransferResult &result) {
+      print_result("bing", result);
+    });
+
+    // Transfers progress only on socket readiness and libcurl timeouts; the
+    // loop exits once no sockets or timers are left.
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    // Both handles are back in the pool now, so this request reuses one of
+    // them together with its DNS cache and TLS sessions. Its body is discarded
+    // since no sink is set.
+    multi_handle.Add(multi_handle.Acquire("https://www.google.com/"),
+                     [&](curl::EasyHandle &easy,
+                         const curl::TransferResult &result) {
+                       print_result("google (recycled)", result);
+                     });
+    uv_run(loop, UV_RUN_DEFAULT);
 
     return true;
   }
@@ -0,0 +1,64 @@
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+namespace curl {
+
+// Unbounded lock-free multi-producer single-consumer queue (Dmitry Vyukov's
+// intrusive MPSC queue). Push() may be called from any thread; Pop() only
+// from the single consumer thread.
+template <class T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(new Node), tail_(head_.load()) {}
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  ~MpscQueue() {
+    T value;
+    while (Pop(&value)) {
+    }
+    delete tail_;
+  }
+
+  void Push(T &&value) {
+    Node *node = new Node;
+    node->value = std::move(value);
+    Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Returns false when the queue is empty or when a producer is halfway
+  // through Push(); in the latter case the value shows up on a later call.
+  bool Pop(T *value) {
+    Node *tail = tail_;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    *value = std::move(next->value);
+    tail_ = next;
+    delete tail;
+    return true;
+  }
+
+ private:
+  struct Node {
+    Node() : next(nullptr) {}
+
+    std::atomic<Node *> next;
+    T value;
+  };
+
+  // head_ is the most recently pushed node, tail_ the last popped one (or
+  // the initial stub).
+  std::atomic<Node *> head_;
+  Node *tail_;
+};
+
+}  // namespace curl
+
+#endif  // MPSC_QUEUE_H_
@@ -0,0 +1,61 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "curl_fetcher.h"
+#include "uv.h"
+
+// Fetches every URL read from stdin (one per line) with curl::Fetcher and
+// prints a summary.
+int main(int argc, char **argv) {
+  auto config = curl::Fetcher::DefaultConfig();
+  if (argc > 1) {
+    config.num_threads = std::atoi(argv[1]);
+  }
+  if (config.num_threads <= 0) {
+    std::cout << "Usage: " << argv[0] << " [<num-threads>] < urls.txt"
+              << std::endl;
+    return 1;
+  }
+
+  uv_loop_t *loop = uv_default_loop();
+  curl::Fetcher fetcher(loop, config);
+  if (!fetcher) {
+    std::cout << "curl::Fetcher failed" << std::endl;
+    return 1;
+  }
+
+  size_t ok = 0, failed = 0;
+  curl_off_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  std::string url;
+  while (std::getline(std::cin, url)) {
+    if (url.empty()) {
+      continue;
+    }
+    fetcher.Fetch(url, nullptr, [&, url](const curl::TransferResult &result,
+                                         std::unique_ptr<curl::ResponseSink>) {
+      if (result.code == CURLE_OK) {
+        ok++;
+        bytes += result.size_download;
+      } else {
+        failed++;
+        std::cout << url << ": " << curl_easy_strerror(result.code)
+                  << std::endl;
+      }
+    });
+  }
+
+  uv_run(loop, UV_RUN_DEFAULT);
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  std::cout << "threads: " << fetcher.num_threads() << ", ok: " << ok
+            << ", failed: " << failed << ", bytes: " << bytes
+            << ", elapsed: " << elapsed << "ms" << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#ifndef LOOPBACK_HTTP_SERVER_H_
+#define LOOPBACK_HTTP_SERVER_H_
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "uv.h"
+
+// Minimal keep-alive HTTP/1.1 server on 127.0.0.1 that answers every request
+// with the same fixed-size body. It runs its own uv loop on a background
+// thread, so benchmarks need nothing but the loopback interface.
+//
+// Only what the benchmark needs is handled: requests are assumed to have no
+// body and are delimited by the blank line after the headers.
+class LoopbackHttpServer {
+ public:
+  explicit LoopbackHttpServer(size_t payload_size) : port_(0) {
+    response_ = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                "Content-Length: " +
+                std::to_string(payload_size) + "\r\n\r\n";
+    response_.append(payload_size, 'x');
+  }
+
+  ~LoopbackHttpServer() { Stop(); }
+
+  // Binds to |port|, or to an ephemeral port when it is 0, and starts
+  // serving.
+  bool Start(int port) {
+    uv_loop_init(&loop_);
+    uv_tcp_init(&loop_, &listener_);
+    listener_.data = this;
+
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", port, &addr);
+    int r = uv_tcp_bind(&listener_, reinterpret_cast<sockaddr *>(&addr), 0);
+    if (r == 0) {
+      r = uv_listen(reinterpret_cast<uv_stream_t *>(&listener_), 4096,
+                    OnConnection);
+    }
+    if (r != 0) {
+      std::cout << "LoopbackHttpServer: " << uv_strerror(r) << std::endl;
+      uv_close(reinterpret_cast<uv_handle_t *>(&listener_), nullptr);
+      uv_run(&loop_, UV_RUN_DEFAULT);
+      uv_loop_close(&loop_);
+      return false;
+    }
+
+    struct sockaddr_in bound;
+    int len = sizeof(bound);
+    uv_tcp_getsockname(&listener_, reinterpret_cast<sockaddr *>(&bound), &len);
+    port_ = ntohs(bound.sin_port);
+
+    uv_async_init(&loop_, &stop_, OnStop);
+    stop_.data = this;
+    thread_ = std::thread([this]() {
+      uv_run(&loop_, UV_RUN_DEFAULT);
+      uv_loop_close(&loop_);
+    });
+    return true;
+  }
+
+  void Stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    uv_async_send(&stop_);
+    thread_.join();
+  }
+
+  int port() const { return port_; }
+
+ private:
+  struct Connection {
+    uv_tcp_t tcp;
+    LoopbackHttpServer *server;
+    std::string buf;
+    char read_buf[64 * 1024];
+  };
+
+  static void OnConnection(uv_stream_t *listener, int status) {
+    if (status < 0) {
+      return;
+    }
+    auto self = static_cast<LoopbackHttpServer *>(listener->data);
+    auto conn = new Connection;
+    conn->server = self;
+    uv_tcp_init(&self->loop_, &conn->tcp);
+    conn->tcp.data = conn;
+    if (uv_accept(listener, reinterpret_cast<uv_stream_t *>(&conn->tcp)) != 0) {
+      CloseConnection(conn);
+      return;
+    }
+    uv_tcp_nodelay(&conn->tcp, 1);
+    uv_read_start(reinterpret_cast<uv_stream_t *>(&conn->tcp), OnAlloc,
+                  OnRead);
+  }
+
+  static void OnAlloc(uv_handle_t *handle, size_t suggested_size,
+                      uv_buf_t *buf) {
+    auto conn = static_cast<Connection *>(handle->data);
+    *buf = uv_buf_init(conn->read_buf, sizeof(conn->read_buf));
+  }
+
+  static void OnRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+    auto conn = static_cast<Connection *>(stream->data);
+    if (nread < 0) {
+      CloseConnection(conn);
+      return;
+    }
+    conn->buf.append(buf->base, nread);
+
+    size_t pos = 0, end;
+    while ((end = conn->buf.find("\r\n\r\n", pos)) != std::string::npos) {
+      pos = end + 4;
+      // The response is shared by every write and outlives all of them.
+      const std::string &res = conn->server->response_;
+      uv_buf_t wbuf = uv_buf_init(const_cast<char *>(res.data()), res.size());
+      auto req = new uv_write_t;
+      uv_write(req, stream, &wbuf, 1,
+               [](uv_write_t *req, int status) { delete req; });
+    }
+    conn->buf.erase(0, pos);
+  }
+
+  static void CloseConnection(Connection *conn) {
+    uv_close(reinterpret_cast<uv_handle_t *>(&conn->tcp), [](uv_handle_t *h) {
+      delete static_cast<Connection *>(h->data);
+    });
+  }
+
+  static void OnStop(uv_async_t *async) {
+    auto self = static_cast<LoopbackHttpServer *>(async->data);
+    uv_walk(&self->loop_,
+            [](uv_handle_t *h, void *arg) {
+              auto self = static_cast<LoopbackHttpServer *>(arg);
+              if (uv_is_closing(h)) {
+                return;
+              }
+              if (h == reinterpret_cast<uv_handle_t *>(&self->listener_) ||
+                  h == reinterpret_cast<uv_handle_t *>(&self->stop_)) {
+                uv_close(h, nullptr);
+              } else {
+                CloseConnection(static_cast<Connection *>(h->data));
+              }
+            },
+            self);
+  }
+
+  std::string response_;
+  int port_;
+  uv_loop_t loop_;
+  uv_tcp_t listener_;
+  uv_async_t stop_;
+  std::thread thread_;
+};
+
+#endif  // LOOPBACK_HTTP_SERVER_H_
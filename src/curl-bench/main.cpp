@@ -0,0 +1,199 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "uv.h"
+
+#include "curl_easy_handle.h"
+#include "curl_fetcher.h"
+#include "curl_global_context.h"
+#include "curl_multi_handle.h"
+#include "latency_histogram.h"
+#include "loopback_http_server.h"
+
+DEFINE_string(mode, "multi", "Client to drive: easy, multi or fetcher.");
+DEFINE_int32(concurrency, 64, "Number of requests kept in flight.");
+DEFINE_int32(requests, 100000, "Total number of requests.");
+DEFINE_int32(payload_size, 1024, "Response body size in bytes.");
+DEFINE_int32(threads, 4, "Worker threads in fetcher mode.");
+DEFINE_bool(http2, false, "Enable HTTP/2 multiplexing in multi/fetcher mode.");
+DEFINE_int32(port, 0, "Loopback server port. 0 picks a free one.");
+DEFINE_string(url, "", "Benchmark this URL instead of the loopback server.");
+
+using Clock = std::chrono::steady_clock;
+
+struct Stats {
+  Stats() : bytes(0), errors(0) {}
+
+  void Record(Clock::time_point start, const curl::TransferResult &result) {
+    if (result.code != CURLE_OK) {
+      errors++;
+      return;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                  Clock::now() - start)
+                  .count();
+    latency.Record(us);
+    bytes += result.size_download;
+  }
+
+  void Merge(const Stats &other) {
+    latency.Merge(other.latency);
+    bytes += other.bytes;
+    errors += other.errors;
+  }
+
+  LatencyHistogram latency;
+  uint64_t bytes;
+  uint64_t errors;
+};
+
+curl::MultiHandle::Config MultiConfig() {
+  auto config = curl::MultiHandle::DefaultConfig();
+  config.multiplex = FLAGS_http2;
+  return config;
+}
+
+// Each thread runs one EasyHandle with blocking curl_easy_perform calls.
+Stats RunEasy(const std::string &url) {
+  std::atomic<int> issued(0);
+  std::vector<Stats> stats(FLAGS_concurrency);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < FLAGS_concurrency; i++) {
+    threads.emplace_back([&, i]() {
+      curl::EasyHandle easy(url);
+      while (issued++ < FLAGS_requests) {
+        auto start = Clock::now();
+        curl::TransferResult result = {};
+        result.code = curl_easy_perform(easy.raw_handle());
+        curl_easy_getinfo(easy.raw_handle(), CURLINFO_SIZE_DOWNLOAD_T,
+                          &result.size_download);
+        stats[i].Record(start, result);
+      }
+    });
+  }
+  Stats total;
+  for (int i = 0; i < FLAGS_concurrency; i++) {
+    threads[i].join();
+    total.Merge(stats[i]);
+  }
+  return total;
+}
+
+// One MultiHandle on a uv loop; every completion issues the next request.
+Stats RunMulti(const std::string &url) {
+  Stats stats;
+  uv_loop_t *loop = uv_default_loop();
+  {
+    curl::MultiHandle multi(loop, MultiConfig());
+    multi.pool().set_capacity(FLAGS_concurrency);
+    int issued = 0;
+    std::function<void()> issue = [&]() {
+      if (issued >= FLAGS_requests) {
+        return;
+      }
+      issued++;
+      auto start = Clock::now();
+      multi.Add(multi.Acquire(url), [&, start](
+                                        curl::EasyHandle &easy,
+                                        const curl::TransferResult &result) {
+        stats.Record(start, result);
+        issue();
+      });
+    };
+    for (int i = 0; i < FLAGS_concurrency; i++) {
+      issue();
+    }
+    uv_run(loop, UV_RUN_DEFAULT);
+  }
+  uv_run(loop, UV_RUN_DEFAULT);
+  return stats;
+}
+
+// curl::Fetcher with FLAGS_threads workers, driven from the main loop.
+Stats RunFetcher(const std::string &url) {
+  Stats stats;
+  uv_loop_t *loop = uv_default_loop();
+  {
+    auto config = curl::Fetcher::DefaultConfig();
+    config.num_threads = FLAGS_threads;
+    config.multi = MultiConfig();
+    curl::Fetcher fetcher(loop, config);
+    int issued = 0;
+    std::function<void()> issue = [&]() {
+      if (issued >= FLAGS_requests) {
+        return;
+      }
+      issued++;
+      auto start = Clock::now();
+      fetcher.Fetch(url, nullptr,
+                    [&, start](const curl::TransferResult &result,
+                               std::unique_ptr<curl::ResponseSink>) {
+                      stats.Record(start, result);
+                      issue();
+                    });
+    };
+    for (int i = 0; i < FLAGS_concurrency; i++) {
+      issue();
+    }
+    uv_run(loop, UV_RUN_DEFAULT);
+  }
+  uv_run(loop, UV_RUN_DEFAULT);
+  return stats;
+}
+
+int main(int argc, char **argv) {
+  gflags::SetUsageMessage("HTTP client benchmark for the curl wrappers.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::function<Stats(const std::string &)> run;
+  if (FLAGS_mode == "easy") {
+    run = RunEasy;
+  } else if (FLAGS_mode == "multi") {
+    run = RunMulti;
+  } else if (FLAGS_mode == "fetcher") {
+    run = RunFetcher;
+  } else {
+    std::cout << "Unknown mode: " << FLAGS_mode << std::endl;
+    return 1;
+  }
+
+  curl::GlobalContext ctx;
+  if (!ctx) {
+    return 1;
+  }
+
+  LoopbackHttpServer server(FLAGS_payload_size);
+  std::string url = FLAGS_url;
+  if (url.empty()) {
+    if (!server.Start(FLAGS_port)) {
+      return 1;
+    }
+    url = "http://127.0.0.1:" + std::to_string(server.port()) + "/";
+  }
+
+  std::cout << "mode: " << FLAGS_mode << ", url: " << url
+            << ", concurrency: " << FLAGS_concurrency
+            << ", requests: " << FLAGS_requests << std::endl;
+
+  auto start = Clock::now();
+  Stats stats = run(url);
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  const LatencyHistogram &h = stats.latency;
+  std::cout << "completed: " << h.count() << ", errors: " << stats.errors
+            << ", elapsed: " << seconds << "s" << std::endl
+            << "throughput: " << h.count() / seconds << " req/s, "
+            << stats.bytes / seconds / (1024 * 1024) << " MiB/s" << std::endl
+            << "latency (us): mean " << h.mean() << ", p50 "
+            << h.Percentile(0.5) << ", p99 " << h.Percentile(0.99)
+            << ", p999 " << h.Percentile(0.999) << ", max " << h.max()
+            << std::endl;
+  return stats.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+#ifndef CHUNK_PIPELINE_H_
+#define CHUNK_PIPELINE_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Converts a large input in parallel chunks and writes the results in input
+// order.
+//
+// Worker threads cut the next chunk off the input, convert it into a string
+// and queue the result; the calling thread writes queued results in order.
+// A worker only starts a chunk while fewer than max_chunks_in_flight chunks
+// are converted or queued but not yet written, so memory use depends on the
+// chunk size and thread count, never on the input size.
+class ChunkPipeline {
+ public:
+  struct Config {
+    int num_threads;
+    // A chunk is at least this many bytes, rounded up to a record boundary.
+    size_t chunk_size;
+    // 0 means two per thread.
+    int max_chunks_in_flight;
+  };
+
+  static Config DefaultConfig() {
+    return {std::max(1, static_cast<int>(std::thread::hardware_concurrency())),
+            4 * 1024 * 1024, 0};
+  }
+
+  // Returns the end of the chunk that starts at |begin|: the first record
+  // boundary at or after |min_end|. Called with a lock held, so it should
+  // only look ahead as far as one record.
+  using BoundaryFunc = std::function<size_t(size_t begin, size_t min_end)>;
+  // Converts [begin, end) into |out|, on worker |worker| in
+  // [0, num_threads). Returning false stops the run.
+  using ConvertFunc = std::function<bool(int worker, size_t begin, size_t end,
+                                         std::string *out)>;
+  // Called on the calling thread for every chunk, in order. Returning false
+  // stops the run.
+  using WriteFunc =
+      std::function<bool(size_t begin, size_t end, const std::string &out)>;
+
+  explicit ChunkPipeline(const Config &config) : config_(config) {
+    config_.num_threads = std::max(1, config_.num_threads);
+    config_.chunk_size = std::max<size_t>(1, config_.chunk_size);
+    if (config_.max_chunks_in_flight <= 0) {
+      config_.max_chunks_in_flight = config_.num_threads * 2;
+    }
+  }
+
+  // Runs over [0, size) and returns true if every chunk was converted and
+  // written.
+  bool Run(size_t size, const BoundaryFunc &boundary,
+           const ConvertFunc &convert, const WriteFunc &write) {
+    State state;
+    state.active = config_.num_threads;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < config_.num_threads; i++) {
+      threads.emplace_back(
+          [&, i]() { Work(i, size, boundary, convert, &state); });
+    }
+
+    bool ok = true;
+    for (;;) {
+      Result result;
+      {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.done_cv.wait(lock, [&]() {
+          return state.done.count(state.written) > 0 || state.active == 0;
+        });
+        auto it = state.done.find(state.written);
+        if (it == state.done.end()) {
+          break;
+        }
+        result = std::move(it->second);
+        state.done.erase(it);
+      }
+      if (!result.ok || !write(result.begin, result.end, result.out)) {
+        ok = false;
+        break;
+      }
+      {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.written++;
+      }
+      state.space_cv.notify_all();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.failed = state.failed || !ok;
+    }
+    state.space_cv.notify_all();
+    for (auto &t : threads) {
+      t.join();
+    }
+    return !state.failed;
+  }
+
+ private:
+  struct Result {
+    size_t begin;
+    size_t end;
+    std::string out;
+    bool ok;
+  };
+
+  struct State {
+    State() : next_offset(0), taken(0), written(0), active(0), failed(false) {}
+
+    std::mutex mutex;
+    // Signaled when a chunk has been written or the run failed.
+    std::condition_variable space_cv;
+    // Signaled when a chunk has been converted or a worker exits.
+    std::condition_variable done_cv;
+    size_t next_offset;
+    size_t taken;
+    size_t written;
+    int active;
+    bool failed;
+    // Chunk index -> result, for chunks converted but not yet written.
+    std::map<size_t, Result> done;
+  };
+
+  void Work(int worker, size_t size, const BoundaryFunc &boundary,
+            const ConvertFunc &convert, State *state) {
+    for (;;) {
+      size_t index;
+      Result result;
+      {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->space_cv.wait(lock, [&]() {
+          return state->failed || state->next_offset >= size ||
+                 state->taken < state->written + config_.max_chunks_in_flight;
+        });
+        if (state->failed || state->next_offset >= size) {
+          break;
+        }
+        index = state->taken++;
+        result.begin = state->next_offset;
+        result.end = std::min(
+            size, boundary(result.begin,
+                           std::min(size, result.begin + config_.chunk_size)));
+        state->next_offset = result.end;
+      }
+      result.ok = convert(worker, result.begin, result.end, &result.out);
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!result.ok) {
+          state->failed = true;
+          state->space_cv.notify_all();
+        }
+        state->done.emplace(index, std::move(result));
+      }
+      state->done_cv.notify_one();
+    }
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->active--;
+    }
+    state->done_cv.notify_one();
+  }
+
+  Config config_;
+};
+
+#endif  // CHUNK_PIPELINE_H_
@@ -0,0 +1,282 @@
+#ifndef CPPLAB_FAST_PATH_H_
+#define CPPLAB_FAST_PATH_H_
+
+#include <cstring>
+#include <vector>
+
+#include "flatbuffers/flatbuffers.h"
+#include "flatbuffers/idl.h"
+
+#include "cpplab_generated.h"
+#include "json_converter.h"
+#include "json_scan.h"
+
+namespace fbjson {
+
+// Converts cpplab User and UserGroup JSON documents without going through
+// flatbuffers::Parser, for the shape nearly every record has: quoted keys of
+// the schema, each at most once, and string values with no escapes and only
+// ASCII. String bodies are scanned with json_scan and copied straight into
+// the builder through the generated Create functions.
+//
+// Anything else, including every malformed document, makes Convert() return
+// an empty view; the caller then hands the document to a JsonConverter,
+// which produces the result, or the error, the schema defines.
+class CpplabFastPath {
+ public:
+  enum class RootType { kUser, kUserGroup };
+
+  CpplabFastPath(RootType root_type, bool size_prefixed)
+      : root_type_(root_type),
+        size_prefixed_(size_prefixed),
+        p_(nullptr),
+        end_(nullptr),
+        fbb_(1024) {}
+
+  CpplabFastPath(const CpplabFastPath &) = delete;
+  CpplabFastPath &operator=(const CpplabFastPath &) = delete;
+
+  // Returns true if the schema and root type of |parser| are the cpplab ones
+  // this class writes, and stores the root type into |root_type|. Tables
+  // that are only named User or UserGroup, or laid out differently, do not
+  // count: their buffers would not match what the generated code builds.
+  static bool Supports(const flatbuffers::Parser &parser,
+                       RootType *root_type) {
+    const flatbuffers::StructDef *root = parser.root_struct_def_;
+    if (root == nullptr || !parser.file_identifier_.empty()) {
+      return false;
+    }
+    if (IsUser(*root)) {
+      *root_type = RootType::kUser;
+      return true;
+    }
+    if (IsUserGroup(*root)) {
+      *root_type = RootType::kUserGroup;
+      return true;
+    }
+    return false;
+  }
+
+  // Converts [json, json + size). The returned buffer is valid until the next
+  // call and is empty if the document needs the full parser.
+  BufferView Convert(const char *json, size_t size) {
+    p_ = json;
+    end_ = json + size;
+    fbb_.Clear();
+    bool ok;
+    if (root_type_ == RootType::kUser) {
+      flatbuffers::Offset<cpplab::User> user;
+      ok = ParseUser(&user) && AtEnd();
+      if (ok) {
+        Finish(user);
+      }
+    } else {
+      flatbuffers::Offset<cpplab::UserGroup> group;
+      ok = ParseUserGroup(&group) && AtEnd();
+      if (ok) {
+        Finish(group);
+      }
+    }
+    if (!ok) {
+      return {nullptr, 0};
+    }
+    return {fbb_.GetBufferPointer(), fbb_.GetSize()};
+  }
+
+ private:
+  struct Slice {
+    Slice() : data(nullptr), size(0) {}
+
+    bool Is(const char *s) const {
+      return size == std::strlen(s) && std::memcmp(data, s, size) == 0;
+    }
+
+    const char *data;
+    size_t size;
+  };
+
+  static bool IsTable(const flatbuffers::StructDef &def, const char *name,
+                      size_t num_fields) {
+    return !def.fixed && def.defined_namespace != nullptr &&
+           def.defined_namespace->GetFullyQualifiedName(def.name) == name &&
+           def.fields.vec.size() == num_fields;
+  }
+
+  // Checks the |index|-th field of |def| against the one the generated code
+  // writes at |offset|.
+  static bool IsField(const flatbuffers::StructDef &def, size_t index,
+                      const char *name, flatbuffers::BaseType type,
+                      flatbuffers::voffset_t offset) {
+    const flatbuffers::FieldDef &field = *def.fields.vec[index];
+    return field.name == name && field.value.type.base_type == type &&
+           field.value.offset == offset && !field.deprecated;
+  }
+
+  static bool IsUser(const flatbuffers::StructDef &def) {
+    return IsTable(def, "cpplab.User", 2) &&
+           IsField(def, 0, "name", flatbuffers::BASE_TYPE_STRING,
+                   cpplab::User::VT_NAME) &&
+           IsField(def, 1, "location", flatbuffers::BASE_TYPE_STRING,
+                   cpplab::User::VT_LOCATION);
+  }
+
+  static bool IsUserGroup(const flatbuffers::StructDef &def) {
+    if (!IsTable(def, "cpplab.UserGroup", 2) ||
+        !IsField(def, 0, "name", flatbuffers::BASE_TYPE_STRING,
+                 cpplab::UserGroup::VT_NAME) ||
+        !IsField(def, 1, "users", flatbuffers::BASE_TYPE_VECTOR,
+                 cpplab::UserGroup::VT_USERS)) {
+      return false;
+    }
+    const flatbuffers::Type &users = def.fields.vec[1]->value.type;
+    return users.element == flatbuffers::BASE_TYPE_STRUCT &&
+           users.struct_def != nullptr && IsUser(*users.struct_def);
+  }
+
+  template <typename T>
+  void Finish(flatbuffers::Offset<T> root) {
+    if (size_prefixed_) {
+      fbb_.FinishSizePrefixed(root);
+    } else {
+      fbb_.Finish(root);
+    }
+  }
+
+  void SkipSpace() {
+    while (p_ < end_ &&
+           (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+      p_++;
+    }
+  }
+
+  // Skips whitespace and then |c| if it is next.
+  bool Consume(char c) {
+    SkipSpace();
+    if (p_ < end_ && *p_ == c) {
+      p_++;
+      return true;
+    }
+    return false;
+  }
+
+  bool AtEnd() {
+    SkipSpace();
+    return p_ == end_;
+  }
+
+  bool ParseString(Slice *s) {
+    if (!Consume('"')) {
+      return false;
+    }
+    const char *q = json_scan::FindStringSpecial(p_, end_);
+    if (q == end_ || *q != '"') {
+      return false;
+    }
+    s->data = p_;
+    s->size = q - p_;
+    p_ = q + 1;
+    return true;
+  }
+
+  // Parses the members of an object, calling member(key) with the input at
+  // the value, until the closing brace.
+  template <typename MemberFunc>
+  bool ParseObject(const MemberFunc &member) {
+    if (!Consume('{')) {
+      return false;
+    }
+    if (Consume('}')) {
+      return true;
+    }
+    do {
+      Slice key;
+      if (!ParseString(&key) || !Consume(':') || !member(key)) {
+        return false;
+      }
+    } while (Consume(','));
+    return Consume('}');
+  }
+
+  bool ParseUser(flatbuffers::Offset<cpplab::User> *user) {
+    Slice name, location;
+    if (!ParseObject([&](const Slice &key) {
+          Slice *field =
+              key.Is("name") ? &name : key.Is("location") ? &location : nullptr;
+          return field != nullptr && field->data == nullptr &&
+                 ParseString(field);
+        })) {
+      return false;
+    }
+    // A missing required field is reported by the parser.
+    if (name.data == nullptr) {
+      return false;
+    }
+    auto name_offset = fbb_.CreateString(name.data, name.size);
+    flatbuffers::Offset<flatbuffers::String> location_offset;
+    if (location.data != nullptr) {
+      location_offset = fbb_.CreateString(location.data, location.size);
+    }
+    *user = cpplab::CreateUser(fbb_, name_offset, location_offset);
+    return true;
+  }
+
+  bool ParseUsers() {
+    if (!Consume('[')) {
+      return false;
+    }
+    if (Consume(']')) {
+      return true;
+    }
+    do {
+      flatbuffers::Offset<cpplab::User> user;
+      if (!ParseUser(&user)) {
+        return false;
+      }
+      users_.push_back(user);
+    } while (Consume(','));
+    return Consume(']');
+  }
+
+  bool ParseUserGroup(flatbuffers::Offset<cpplab::UserGroup> *group) {
+    Slice name;
+    bool has_users = false;
+    users_.clear();
+    if (!ParseObject([&](const Slice &key) {
+          if (key.Is("name")) {
+            return name.data == nullptr && ParseString(&name);
+          }
+          if (key.Is("users") && !has_users) {
+            has_users = true;
+            return ParseUsers();
+          }
+          return false;
+        })) {
+      return false;
+    }
+    if (name.data == nullptr) {
+      return false;
+    }
+    // Users were built while parsing; tables cannot nest in the builder, so
+    // the group itself comes last.
+    auto name_offset = fbb_.CreateString(name.data, name.size);
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<cpplab::User>>>
+        users_offset;
+    if (has_users) {
+      users_offset = fbb_.CreateVector(users_);
+    }
+    *group = cpplab::CreateUserGroup(fbb_, name_offset, users_offset);
+    return true;
+  }
+
+  RootType root_type_;
+  bool size_prefixed_;
+  const char *p_;
+  const char *end_;
+  // Reused across documents, like the builder.
+  std::vector<flatbuffers::Offset<cpplab::User>> users_;
+  flatbuffers::FlatBufferBuilder fbb_;
+};
+
+}  // namespace fbjson
+
+#endif  // CPPLAB_FAST_PATH_H_
@@ -0,0 +1,117 @@
+#ifndef CPPLAB_JSON_WRITER_H_
+#define CPPLAB_JSON_WRITER_H_
+
+#include <string>
+
+#include "flatbuffers/flatbuffers.h"
+
+#include "cpplab_generated.h"
+#include "json_scan.h"
+
+namespace fbjson {
+
+// Appends cpplab tables to a string as compact JSON, the inverse of
+// CpplabFastPath. Fields are written by the generated accessors, with no
+// reflection or schema lookups, and absent optional fields are left out as
+// flatc does. The output can be parsed back by flatbuffers::Parser.
+class CpplabJsonWriter {
+ public:
+  static void AppendUser(const cpplab::User &user, std::string *out) {
+    out->push_back('{');
+    bool first = true;
+    AppendField("name", user.name(), &first, out);
+    AppendField("location", user.location(), &first, out);
+    out->push_back('}');
+  }
+
+  static void AppendUserGroup(const cpplab::UserGroup &group,
+                              std::string *out) {
+    out->push_back('{');
+    bool first = true;
+    AppendField("name", group.name(), &first, out);
+    if (group.users() != nullptr) {
+      out->append(first ? "\"users\":[" : ",\"users\":[");
+      first = false;
+      bool first_user = true;
+      for (const cpplab::User *user : *group.users()) {
+        if (!first_user) {
+          out->push_back(',');
+        }
+        first_user = false;
+        AppendUser(*user, out);
+      }
+      out->push_back(']');
+    }
+    out->push_back('}');
+  }
+
+  // Appends |s| as a quoted JSON string. Runs of plain characters, found with
+  // json_scan, are copied at once; UTF-8 is passed through unchanged.
+  static void AppendString(const char *s, size_t size, std::string *out) {
+    static const char kHex[] = "0123456789abcdef";
+    const char *end = s + size;
+    out->push_back('"');
+    while (s < end) {
+      const char *special = json_scan::FindStringSpecial(s, end);
+      out->append(s, special);
+      if (special == end) {
+        break;
+      }
+      unsigned char c = static_cast<unsigned char>(*special);
+      switch (c) {
+        case '"':
+          out->append("\\\"");
+          break;
+        case '\\':
+          out->append("\\\\");
+          break;
+        case '\b':
+          out->append("\\b");
+          break;
+        case '\f':
+          out->append("\\f");
+          break;
+        case '\n':
+          out->append("\\n");
+          break;
+        case '\r':
+          out->append("\\r");
+          break;
+        case '\t':
+          out->append("\\t");
+          break;
+        default:
+          if (c < 0x20) {
+            out->append("\\u00");
+            out->push_back(kHex[c >> 4]);
+            out->push_back(kHex[c & 0xf]);
+          } else {
+            out->push_back(static_cast<char>(c));
+          }
+          break;
+      }
+      s = special + 1;
+    }
+    out->push_back('"');
+  }
+
+ private:
+  static void AppendField(const char *key, const flatbuffers::String *value,
+                          bool *first, std::string *out) {
+    if (value == nullptr) {
+      return;
+    }
+    if (!*first) {
+      out->push_back(',');
+    }
+    *first = false;
+    out->push_back('"');
+    out->append(key);
+    out->append("\":");
+    AppendString(value->c_str(), value->size(), out);
+  }
+};
+
+}  // namespace fbjson
+
+#endif  // CPPLAB_JSON_WRITER_H_
@@ -0,0 +1,98 @@
+#ifndef JSON_SCAN_H_
+#define JSON_SCAN_H_
+
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define JSON_SCAN_X86 1
+#endif
+
+// Vectorized scanning of JSON string contents.
+//
+// FindStringSpecial() returns the first byte in [p, end) that ends a plain
+// string body: a quote, a backslash, a control character or any non-ASCII
+// byte, or |end| if there is none. Strings without escapes and non-ASCII
+// text can then be used as they are; anything else is left to a full
+// parser.
+//
+// On x86-64 the bytes are checked 32 at a time with AVX2 when the CPU has
+// it, or 16 at a time with SSE2, which every x86-64 CPU has; other CPUs use
+// the scalar loop. Treating bytes as signed, one "less than 0x20" compare
+// catches both control characters and non-ASCII bytes.
+namespace json_scan {
+
+inline const char *FindStringSpecialScalar(const char *p, const char *end) {
+  for (; p < end; p++) {
+    unsigned char c = static_cast<unsigned char>(*p);
+    if (c == '"' || c == '\\' || c < 0x20 || c >= 0x80) {
+      return p;
+    }
+  }
+  return end;
+}
+
+#ifdef JSON_SCAN_X86
+
+inline const char *FindStringSpecialSSE2(const char *p, const char *end) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i space = _mm_set1_epi8(0x20);
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+        _mm_cmplt_epi8(v, space));
+    int mask = _mm_movemask_epi8(special);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return FindStringSpecialScalar(p, end);
+}
+
+__attribute__((target("avx2"))) inline const char *FindStringSpecialAVX2(
+    const char *p, const char *end) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i space = _mm256_set1_epi8(0x20);
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i special = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                        _mm256_cmpeq_epi8(v, backslash)),
+        // AVX2 has no less-than; 0x20 > v is the same.
+        _mm256_cmpgt_epi8(space, v));
+    uint32_t mask = _mm256_movemask_epi8(special);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+  return FindStringSpecialSSE2(p, end);
+}
+
+#endif  // JSON_SCAN_X86
+
+using FindFunc = const char *(*)(const char *p, const char *end);
+
+// Picks the widest implementation the CPU supports, once.
+inline FindFunc SelectFindStringSpecial() {
+#ifdef JSON_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return FindStringSpecialAVX2;
+  }
+  return FindStringSpecialSSE2;
+#else
+  return FindStringSpecialScalar;
+#endif
+}
+
+inline const char *FindStringSpecial(const char *p, const char *end) {
+  static const FindFunc find = SelectFindStringSpecial();
+  return find(p, end);
+}
+
+}  // namespace json_scan
+
+#endif  // JSON_SCAN_H_
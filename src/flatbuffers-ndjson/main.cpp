@@ -0,0 +1,382 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flatbuffers/flatbuffers.h"
+#include "flatbuffers/idl.h"
+#include "gflags/gflags.h"
+
+#include "chunk_pipeline.h"
+#include "cpplab_fast_path.h"
+#include "cpplab_json_writer.h"
+#include "json_converter.h"
+#include "mapped_file.h"
+#include "size_prefix_walker.h"
+
+DEFINE_string(input, "", "Input file.");
+DEFINE_string(output, "", "Output file.");
+DEFINE_string(schema, "src/flatbuffers-parse-json/cpplab.fbs",
+              "Schema, as .fbs or .bfbs.");
+DEFINE_string(root_type, "User",
+              "Root type of every record. export takes User or UserGroup.");
+DEFINE_int32(threads, 0, "Worker threads. 0 uses every core.");
+DEFINE_int32(chunk_size_kb, 4096, "Input handed to a worker at a time.");
+DEFINE_int32(max_chunks_in_flight, 0,
+             "Chunks converted but not yet written. 0 means two per thread.");
+DEFINE_bool(skip_errors, false,
+            "Skip records that fail to convert instead of stopping.");
+DEFINE_bool(fast_path, true,
+            "Convert User and UserGroup records of the common shape without "
+            "flatbuffers::Parser. Only used with the cpplab schema.");
+DEFINE_string(format, "ndjson",
+              "export output: ndjson, one record per line, or json, one "
+              "array of all records.");
+DEFINE_bool(verify, true, "Verify every record before export.");
+
+using Clock = std::chrono::steady_clock;
+
+struct WorkerStats {
+  WorkerStats() : records(0), errors(0), fallbacks(0), error_offset(0) {}
+
+  // Keeps the error at the smallest input offset, the one a single-threaded
+  // run would have stopped at.
+  void SetError(size_t offset, const std::string &message) {
+    if (error.empty() || offset < error_offset) {
+      error_offset = offset;
+      error = message;
+    }
+  }
+
+  void Add(const WorkerStats &other) {
+    records += other.records;
+    errors += other.errors;
+    fallbacks += other.fallbacks;
+    if (!other.error.empty()) {
+      SetError(other.error_offset, other.error);
+    }
+  }
+
+  uint64_t records;
+  uint64_t errors;
+  // Records the fast path handed over to the parser.
+  uint64_t fallbacks;
+  // The first error and the input offset of its record.
+  size_t error_offset;
+  std::string error;
+};
+
+// Converts a chunk like ChunkPipeline::ConvertFunc, counting into |stats|.
+using CountingConvertFunc = std::function<bool(
+    int worker, size_t begin, size_t end, std::string *out,
+    WorkerStats *stats)>;
+
+// Adapts |convert| to ChunkPipeline. Every chunk is counted into a local
+// WorkerStats that is added to (*stats)[worker] once at the end, so workers
+// do not keep writing to neighbouring elements of |stats|.
+ChunkPipeline::ConvertFunc CountPerChunk(std::vector<WorkerStats> *stats,
+                                         const CountingConvertFunc &convert) {
+  return [stats, convert](int worker, size_t begin, size_t end,
+                          std::string *out) {
+    WorkerStats chunk_stats;
+    bool ok = convert(worker, begin, end, out, &chunk_stats);
+    (*stats)[worker].Add(chunk_stats);
+    return ok;
+  };
+}
+
+ChunkPipeline::Config PipelineConfig() {
+  auto config = ChunkPipeline::DefaultConfig();
+  if (FLAGS_threads > 0) {
+    config.num_threads = FLAGS_threads;
+  }
+  config.chunk_size = static_cast<size_t>(FLAGS_chunk_size_kb) * 1024;
+  config.max_chunks_in_flight = FLAGS_max_chunks_in_flight;
+  return config;
+}
+
+// Prints the totals of a run and returns the exit code.
+int Report(const std::vector<WorkerStats> &stats, bool ok, size_t bytes_in,
+           uint64_t bytes_out, double seconds, bool fast_path) {
+  WorkerStats total;
+  for (auto &s : stats) {
+    total.Add(s);
+  }
+  double mib = 1024.0 * 1024.0;
+  std::cout << "records: " << total.records << ", errors: " << total.errors
+            << ", threads: " << stats.size() << std::endl;
+  if (fast_path) {
+    std::cout << "fast path: " << total.records + total.errors - total.fallbacks
+              << ", parser: " << total.fallbacks << std::endl;
+  }
+  std::cout << "input: " << bytes_in / mib << " MiB, output: "
+            << bytes_out / mib << " MiB, elapsed: " << seconds << "s"
+            << std::endl
+            << "throughput: " << total.records / seconds << " records/s, "
+            << bytes_in / seconds / mib << " MiB/s" << std::endl;
+  if (!total.error.empty()) {
+    std::cout << total.error << std::endl;
+  }
+  if (!ok) {
+    std::cout << "Failed." << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Converts every line of FLAGS_input, a User or UserGroup JSON document per
+// line, and writes the results to FLAGS_output as a stream of size-prefixed
+// FlatBuffers, in input order. Blank lines are skipped.
+int Ingest() {
+  MappedFile input;
+  if (!input.Open(FLAGS_input, true)) {
+    std::cout << input.error() << std::endl;
+    return 1;
+  }
+  std::unique_ptr<FILE, decltype(&fclose)> output(
+      fopen(FLAGS_output.c_str(), "wb"), fclose);
+  if (!output) {
+    std::cout << "Failed to open " << FLAGS_output << std::endl;
+    return 1;
+  }
+
+  auto config = PipelineConfig();
+  flatbuffers::IDLOptions opts;
+  opts.size_prefixed = true;
+  fbjson::JsonConverter prototype(opts);
+  if (!prototype.LoadSchema(FLAGS_schema, FLAGS_root_type)) {
+    std::cout << prototype.error() << std::endl;
+    return 1;
+  }
+  // One converter per worker; the schema is not parsed again.
+  std::vector<std::unique_ptr<fbjson::JsonConverter>> converters;
+  for (int i = 0; i < config.num_threads; i++) {
+    converters.push_back(prototype.Clone());
+    if (!converters.back()) {
+      std::cout << "Failed to clone the converter." << std::endl;
+      return 1;
+    }
+  }
+  std::vector<std::unique_ptr<fbjson::CpplabFastPath>> fast_paths;
+  fbjson::CpplabFastPath::RootType root_type;
+  // Decided by the loaded schema, not by --root_type, which other schemas
+  // may use too.
+  if (FLAGS_fast_path &&
+      fbjson::CpplabFastPath::Supports(prototype.parser(), &root_type)) {
+    for (int i = 0; i < config.num_threads; i++) {
+      fast_paths.emplace_back(new fbjson::CpplabFastPath(root_type, true));
+    }
+  }
+  std::vector<WorkerStats> stats(config.num_threads);
+
+  const char *data = input.data();
+  size_t size = input.size();
+  auto boundary = [data, size](size_t begin, size_t min_end) {
+    auto nl = static_cast<const char *>(
+        std::memchr(data + min_end, '\n', size - min_end));
+    return nl != nullptr ? nl - data + 1 : size;
+  };
+  auto convert = [&](int worker, size_t begin, size_t end, std::string *out,
+                     WorkerStats *s) {
+    fbjson::JsonConverter &converter = *converters[worker];
+    // Holds the line with the NUL terminator the parser needs.
+    std::string line;
+    out->reserve(end - begin);
+    for (size_t pos = begin; pos < end;) {
+      auto nl = static_cast<const char *>(
+          std::memchr(data + pos, '\n', end - pos));
+      size_t eol = nl != nullptr ? nl - data : end;
+      size_t line_begin = pos;
+      pos = eol + 1;
+      if (line_begin == eol ||
+          (eol - line_begin == 1 && data[line_begin] == '\r')) {
+        continue;
+      }
+      fbjson::BufferView buf = {nullptr, 0};
+      if (!fast_paths.empty()) {
+        buf = fast_paths[worker]->Convert(data + line_begin, eol - line_begin);
+        s->fallbacks += buf.empty();
+      }
+      if (buf.empty()) {
+        line.assign(data + line_begin, eol - line_begin);
+        buf = converter.Convert(line);
+      }
+      if (buf.empty()) {
+        if (s->error.empty()) {
+          s->SetError(line_begin, "Line at byte " + std::to_string(line_begin) +
+                                      ": " + converter.error());
+        }
+        s->errors++;
+        if (!FLAGS_skip_errors) {
+          return false;
+        }
+        continue;
+      }
+      out->append(reinterpret_cast<const char *>(buf.data), buf.size);
+      s->records++;
+    }
+    return true;
+  };
+  uint64_t bytes_out = 0;
+  auto write = [&](size_t begin, size_t end, const std::string &out) {
+    if (fwrite(out.data(), 1, out.size(), output.get()) != out.size()) {
+      return false;
+    }
+    bytes_out += out.size();
+    // Nothing reads this part of the input again.
+    input.Release(begin, end - begin);
+    return true;
+  };
+
+  auto start = Clock::now();
+  ChunkPipeline pipeline(config);
+  bool ok =
+      pipeline.Run(size, boundary, CountPerChunk(&stats, convert), write);
+  ok = fclose(output.release()) == 0 && ok;
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  return Report(stats, ok, size, bytes_out, seconds, !fast_paths.empty());
+}
+
+// Converts FLAGS_input, a stream of size-prefixed User or UserGroup
+// FlatBuffers such as ingest writes, back to JSON in FLAGS_output.
+int Export() {
+  bool group = FLAGS_root_type == "UserGroup";
+  if (!group && FLAGS_root_type != "User") {
+    std::cout << "export takes --root_type=User or UserGroup." << std::endl;
+    return 1;
+  }
+  if (FLAGS_format != "ndjson" && FLAGS_format != "json") {
+    std::cout << "Unknown format: " << FLAGS_format << std::endl;
+    return 1;
+  }
+  bool array = FLAGS_format == "json";
+  MappedFile input;
+  if (!input.Open(FLAGS_input, true)) {
+    std::cout << input.error() << std::endl;
+    return 1;
+  }
+  std::unique_ptr<FILE, decltype(&fclose)> output(
+      fopen(FLAGS_output.c_str(), "wb"), fclose);
+  if (!output) {
+    std::cout << "Failed to open " << FLAGS_output << std::endl;
+    return 1;
+  }
+
+  auto config = PipelineConfig();
+  std::vector<WorkerStats> stats(config.num_threads);
+  const char *data = input.data();
+  size_t size = input.size();
+  auto start = Clock::now();
+  // Found by walking the size prefixes a few chunks ahead of the workers.
+  SizePrefixWalker walker(data, size, config.chunk_size,
+                          config.max_chunks_in_flight > 0
+                              ? config.max_chunks_in_flight
+                              : config.num_threads * 2);
+  auto boundary = [&walker](size_t /* begin */, size_t /* min_end */) {
+    return walker.NextEnd();
+  };
+  auto convert = [&](int /* worker */, size_t begin, size_t end,
+                     std::string *out, WorkerStats *s) {
+    // JSON is usually about twice the size of the buffers.
+    out->reserve((end - begin) * 2);
+    for (size_t pos = begin; pos < end;) {
+      size_t record_size = 0;
+      if (pos + sizeof(uint32_t) <= end) {
+        record_size = sizeof(uint32_t) +
+                      flatbuffers::ReadScalar<uint32_t>(data + pos);
+      }
+      if (record_size == 0 || pos + record_size > end) {
+        s->SetError(pos, "Truncated record at byte " + std::to_string(pos));
+        s->errors++;
+        return false;
+      }
+      auto buf = reinterpret_cast<const uint8_t *>(data + pos);
+      size_t record_begin = pos;
+      pos += record_size;
+      if (FLAGS_verify) {
+        flatbuffers::Verifier verifier(buf, record_size);
+        if (group ? !verifier.VerifySizePrefixedBuffer<cpplab::UserGroup>(
+                        nullptr)
+                  : !verifier.VerifySizePrefixedBuffer<cpplab::User>(nullptr)) {
+          if (s->error.empty()) {
+            s->SetError(record_begin, "Invalid record at byte " +
+                                          std::to_string(record_begin));
+          }
+          s->errors++;
+          if (!FLAGS_skip_errors) {
+            return false;
+          }
+          continue;
+        }
+      }
+      // In a JSON array every record is preceded by a separator, and the
+      // one before the first record written is dropped by the writer, since
+      // a chunk does not know if records before it were skipped.
+      if (array) {
+        out->append(",\n");
+      }
+      if (group) {
+        fbjson::CpplabJsonWriter::AppendUserGroup(
+            *flatbuffers::GetSizePrefixedRoot<cpplab::UserGroup>(buf), out);
+      } else {
+        fbjson::CpplabJsonWriter::AppendUser(
+            *flatbuffers::GetSizePrefixedRoot<cpplab::User>(buf), out);
+      }
+      if (!array) {
+        out->push_back('\n');
+      }
+      s->records++;
+    }
+    return true;
+  };
+  uint64_t bytes_out = 0;
+  auto write = [&](const char *s, size_t n) {
+    if (fwrite(s, 1, n, output.get()) != n) {
+      return false;
+    }
+    bytes_out += n;
+    return true;
+  };
+  bool separator = false;
+  auto write_chunk = [&](size_t begin, size_t end, const std::string &out) {
+    input.Release(begin, end - begin);
+    size_t skip = array && !separator && !out.empty() ? 2 : 0;
+    separator = separator || !out.empty();
+    return write(out.data() + skip, out.size() - skip);
+  };
+
+  ChunkPipeline pipeline(config);
+  bool ok = (!array || write("[\n", 2)) &&
+            pipeline.Run(size, boundary, CountPerChunk(&stats, convert),
+                         write_chunk) &&
+            (!array || write("\n]\n", 3));
+  ok = fclose(output.release()) == 0 && ok;
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return Report(stats, ok, size, bytes_out, seconds, false);
+}
+
+int main(int argc, char **argv) {
+  gflags::SetUsageMessage(
+      "Converts between NDJSON and size-prefixed FlatBuffers.\n"
+      "Usage: flatbuffers-ndjson ingest --input=<ndjson> --output=<file>\n"
+      "       flatbuffers-ndjson export --input=<file> --output=<ndjson>");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::string command = argc > 1 ? argv[1] : "";
+  if (FLAGS_input.empty() || FLAGS_output.empty()) {
+    std::cout << "--input and --output are required." << std::endl;
+    return 1;
+  }
+  if (command == "ingest") {
+    return Ingest();
+  } else if (command == "export") {
+    return Export();
+  }
+  std::cout << "Unknown command: " << command << std::endl;
+  return 1;
+}
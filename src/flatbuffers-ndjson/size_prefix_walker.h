@@ -0,0 +1,111 @@
+#ifndef SIZE_PREFIX_WALKER_H_
+#define SIZE_PREFIX_WALKER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "flatbuffers/flatbuffers.h"
+
+// Finds chunk boundaries in a stream of size-prefixed buffers for
+// ChunkPipeline.
+//
+// Such records are not self-delimiting, so the only way to find a boundary
+// is to walk the size prefixes from the start, one load per record. A
+// thread of its own does that while the pipeline runs, at most |max_ahead|
+// chunks ahead of it. The input is thus read once and in parallel with the
+// conversion, and the pipeline's boundary function, called with its lock
+// held, only takes the next boundary off a queue.
+class SizePrefixWalker {
+ public:
+  // A chunk ends at the first record boundary at least |chunk_size| bytes
+  // past its beginning, like ChunkPipeline::Config::chunk_size.
+  SizePrefixWalker(const char *data, size_t size, size_t chunk_size,
+                   int max_ahead)
+      : data_(data),
+        size_(size),
+        chunk_size_(chunk_size),
+        max_ahead_(static_cast<size_t>(max_ahead > 0 ? max_ahead : 1)),
+        done_(false),
+        stopping_(false) {
+    thread_ = std::thread([this]() { Run(); });
+  }
+
+  SizePrefixWalker(const SizePrefixWalker &) = delete;
+  SizePrefixWalker &operator=(const SizePrefixWalker &) = delete;
+
+  ~SizePrefixWalker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    space_cv_.notify_one();
+    thread_.join();
+  }
+
+  // Returns the end of the next chunk, the first one beginning at 0 and
+  // every other one where the previous ended. The last chunk ends at the
+  // end of the input, even if that is within a truncated record.
+  size_t NextEnd() {
+    size_t end;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_cv_.wait(lock, [this]() { return !ends_.empty() || done_; });
+      if (ends_.empty()) {
+        return size_;
+      }
+      end = ends_.front();
+      ends_.pop_front();
+    }
+    space_cv_.notify_one();
+    return end;
+  }
+
+ private:
+  void Run() {
+    size_t pos = 0;
+    size_t chunk_begin = 0;
+    while (pos + sizeof(uint32_t) <= size_) {
+      pos += sizeof(uint32_t) + flatbuffers::ReadScalar<uint32_t>(data_ + pos);
+      if (pos >= size_ || pos - chunk_begin < chunk_size_) {
+        continue;
+      }
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_cv_.wait(lock, [this]() {
+          return stopping_ || ends_.size() < max_ahead_;
+        });
+        if (stopping_) {
+          return;
+        }
+        ends_.push_back(pos);
+      }
+      ready_cv_.notify_one();
+      chunk_begin = pos;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    ready_cv_.notify_one();
+  }
+
+  const char *data_;
+  size_t size_;
+  size_t chunk_size_;
+  size_t max_ahead_;
+  std::mutex mutex_;
+  // Signaled when a boundary was found or the walk is done.
+  std::condition_variable ready_cv_;
+  // Signaled when a boundary was taken or the walker is stopping.
+  std::condition_variable space_cv_;
+  // Boundaries found but not taken yet, in order.
+  std::deque<size_t> ends_;
+  bool done_;
+  bool stopping_;
+  std::thread thread_;
+};
+
+#endif  // SIZE_PREFIX_WALKER_H_
@@ -0,0 +1,139 @@
+#ifndef JSON_CONVERTER_H_
+#define JSON_CONVERTER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "flatbuffers/flatbuffers.h"
+#include "flatbuffers/idl.h"
+#include "flatbuffers/util.h"
+
+namespace fbjson {
+
+// A FlatBuffer owned by someone else.
+struct BufferView {
+  const uint8_t *data;
+  size_t size;
+
+  bool empty() const { return size == 0; }
+};
+
+// Converts JSON documents to FlatBuffers of one root type.
+//
+// The schema is parsed once, from a .fbs file or from a binary schema
+// (.bfbs, made by `flatc --binary --schema`), which skips the schema parser
+// altogether. Every Convert() then only parses the JSON, into the same
+// builder, which is cleared rather than freed in between; after the first
+// few documents a conversion allocates nothing.
+//
+// Not thread-safe. Use one converter per thread; Clone() makes a copy
+// without going through the schema files again.
+class JsonConverter {
+ public:
+  JsonConverter() {}
+
+  // E.g. with |opts|.size_prefixed set, every buffer starts with its size,
+  // ready to be appended to a stream of buffers.
+  explicit JsonConverter(const flatbuffers::IDLOptions &opts)
+      : parser_(opts) {}
+
+  JsonConverter(const JsonConverter &) = delete;
+  JsonConverter &operator=(const JsonConverter &) = delete;
+
+  // Loads |path|, as a binary schema if it ends with ".bfbs", and sets the
+  // root type to |root_type|, or to the schema's root_type if it is empty.
+  bool LoadSchema(const std::string &path, const std::string &root_type) {
+    std::string schema;
+    bool binary = path.size() > 5 && path.substr(path.size() - 5) == ".bfbs";
+    if (!flatbuffers::LoadFile(path.c_str(), binary, &schema)) {
+      error_ = "Failed to load " + path;
+      return false;
+    }
+    if (binary) {
+      if (!parser_.Deserialize(reinterpret_cast<const uint8_t *>(schema.data()),
+                               schema.size())) {
+        error_ = "Failed to deserialize " + path;
+        return false;
+      }
+    } else {
+      std::string dir = flatbuffers::StripFileName(path);
+      const char *include_paths[] = {dir.c_str(), nullptr};
+      if (!parser_.Parse(schema.c_str(), include_paths, path.c_str())) {
+        error_ = parser_.error_;
+        return false;
+      }
+    }
+    if (!root_type.empty()) {
+      return SetRootType(root_type);
+    }
+    if (parser_.root_struct_def_ == nullptr) {
+      return Fail("No root type in " + path);
+    }
+    return true;
+  }
+
+  bool SetRootType(const std::string &root_type) {
+    if (!parser_.SetRootType(root_type.c_str())) {
+      return Fail("Unknown root type: " + root_type);
+    }
+    return true;
+  }
+
+  // Returns a converter with the same schema, root type and options, or null
+  // if the schema cannot be round-tripped. The buffer of the last Convert()
+  // stays valid.
+  std::unique_ptr<JsonConverter> Clone() {
+    // Serialize() writes into the parser's builder, so the last result is
+    // set aside in |last| meanwhile and swapped back afterwards.
+    flatbuffers::FlatBufferBuilder last;
+    last.Swap(parser_.builder_);
+    parser_.Serialize();
+    std::unique_ptr<JsonConverter> clone(new JsonConverter(parser_.opts));
+    bool ok = clone->parser_.Deserialize(parser_.builder_.GetBufferPointer(),
+                                         parser_.builder_.GetSize());
+    parser_.builder_.Swap(last);
+    if (!ok || (parser_.root_struct_def_ != nullptr &&
+                !clone->SetRootType(parser_.root_struct_def_->name))) {
+      return nullptr;
+    }
+    return clone;
+  }
+
+  // Converts the NUL-terminated |json|. The returned buffer is valid until
+  // the next call and is empty on failure; see error().
+  BufferView Convert(const char *json) {
+    // The parser refuses a second JSON object while the builder holds one.
+    parser_.builder_.Clear();
+    if (!parser_.Parse(json)) {
+      error_ = parser_.error_;
+      return {nullptr, 0};
+    }
+    return {parser_.builder_.GetBufferPointer(), parser_.builder_.GetSize()};
+  }
+
+  BufferView Convert(const std::string &json) { return Convert(json.c_str()); }
+
+  // The builder behind the last Convert(), e.g. to take the buffer over
+  // with ReleaseBufferPointer().
+  flatbuffers::FlatBufferBuilder &builder() { return parser_.builder_; }
+
+  // The loaded schema, e.g. to check which one it is.
+  const flatbuffers::Parser &parser() const { return parser_; }
+
+  const std::string &error() const { return error_; }
+
+ private:
+  bool Fail(const std::string &error) {
+    error_ = error;
+    return false;
+  }
+
+  flatbuffers::Parser parser_;
+  std::string error_;
+};
+
+}  // namespace fbjson
+
+#endif  // JSON_CONVERTER_H_
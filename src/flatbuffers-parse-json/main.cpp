@@ -1,103 +1,89 @@
+#include <chrono>
 #include <iostream>
+#include <string>
 #include "flatbuffers/flatbuffers.h"
-#include "flatbuffers/idl.h"
 #include "flatbuffers/util.h"
 
 #include "cpplab_generated.h"
+#include "json_converter.h"
 
 const char* kCpplabFbsPath = "src/flatbuffers-parse-json/cpplab.fbs";
 const char* kFooUserJsonPath = "src/flatbuffers-parse-json/foo_user.json";
 const char* kFooGroupJsonPath = "src/flatbuffers-parse-json/foo_group.json";
+const int kBenchDocuments = 100000;
 
+bool LoadJson(const char* path, std::string* data) {
+  std::cout << "Load json file: " << path << std::endl;
+  if (!flatbuffers::LoadFile(path, false, data)) {
+    std::cout << "  => Failed..." << std::endl;
+    return false;
+  }
+  std::cout << "  => OK" << std::endl;
+  return true;
+}
+
+// Usage: flatbuffers-parse-json [schema.fbs|schema.bfbs]
 int main(int argc, char** argv) {
-  {
-    flatbuffers::Parser parser;
-    std::cout << "Load fbs file: " << kCpplabFbsPath << std::endl;
-    std::string fbs;
-    if (!flatbuffers::LoadFile(kCpplabFbsPath, false, &fbs)) {
-      std::cout << "  => Failed..." << std::endl;
-      return 1;
-    }
-    std::cout << "  => OK" << std::endl;
-    std::cout << "Parse fbs data." << std::endl;
-    if (!parser.Parse(fbs.c_str())) {
-      std::cout << "  => Failed..." << std::endl
-                << "Fbs data:" << std::endl
-                << "===" << std::endl
-                << fbs << std::endl
-                << "===" << std::endl;
-      return 1;
-    }
-    std::cout << "  => OK" << std::endl;
+  std::string schema_path = argc > 1 ? argv[1] : kCpplabFbsPath;
+
+  // The schema is parsed once; the UserGroup converter is a clone.
+  fbjson::JsonConverter user_converter;
+  std::cout << "Load schema: " << schema_path << std::endl;
+  if (!user_converter.LoadSchema(schema_path, "User")) {
+    std::cout << "  => Failed... " << user_converter.error() << std::endl;
+    return 1;
+  }
+  std::cout << "  => OK" << std::endl;
+  auto group_converter = user_converter.Clone();
+  if (!group_converter || !group_converter->SetRootType("UserGroup")) {
+    std::cout << "Failed to clone the converter." << std::endl;
+    return 1;
+  }
 
-    std::cout << "Load json file: " << kFooUserJsonPath << std::endl;
-    std::string user_data;
-    if (!flatbuffers::LoadFile(kFooUserJsonPath, false, &user_data)) {
-      std::cout << "  => Failed..." << std::endl;
-      return 1;
-    }
-    std::cout << "  => OK" << std::endl;
-    std::cout << "Parse json data" << std::endl;
-    parser.SetRootType("User");
-    if (!parser.Parse(user_data.c_str())) {
-      std::cout << "  => Failed..." << std::endl
-                << "JSON data:" << std::endl
-                << "===" << std::endl
-                << user_data << std::endl
-                << "===" << std::endl;
-    }
-    std::cout << "  => OK" << std::endl;
-    auto user =
-        flatbuffers::GetRoot<cpplab::User>(parser.builder_.GetBufferPointer());
-    std::cout << "# User name: " << user->name()->str() << std::endl
-              << "# Location: " << user->location()->str() << std::endl;
+  std::string user_data;
+  if (!LoadJson(kFooUserJsonPath, &user_data)) {
+    return 1;
+  }
+  std::cout << "Parse json data" << std::endl;
+  fbjson::BufferView buf = user_converter.Convert(user_data);
+  if (buf.empty()) {
+    std::cout << "  => Failed... " << user_converter.error() << std::endl;
+    return 1;
   }
+  std::cout << "  => OK" << std::endl;
+  auto user = flatbuffers::GetRoot<cpplab::User>(buf.data);
+  std::cout << "# User name: " << user->name()->str() << std::endl
+            << "# Location: " << user->location()->str() << std::endl;
 
-  {
-    flatbuffers::Parser parser;
-    std::cout << "Load fbs file: " << kCpplabFbsPath << std::endl;
-    std::string fbs;
-    if (!flatbuffers::LoadFile(kCpplabFbsPath, false, &fbs)) {
-      std::cout << "  => Failed..." << std::endl;
-      return 1;
-    }
-    std::cout << "  => OK" << std::endl;
-    std::cout << "Parse fbs file data." << std::endl;
-    if (!parser.Parse(fbs.c_str())) {
-      std::cout << "  => Failed..." << std::endl
-                << "Fbs data:" << std::endl
-                << "===" << std::endl
-                << fbs << std::endl
-                << "===" << std::endl;
-      return 1;
-    }
-    std::cout << "  => OK" << std::endl;
+  std::string group_data;
+  if (!LoadJson(kFooGroupJsonPath, &group_data)) {
+    return 1;
+  }
+  std::cout << "Parse json data" << std::endl;
+  buf = group_converter->Convert(group_data);
+  if (buf.empty()) {
+    std::cout << "  => Failed... " << group_converter->error() << std::endl;
+    return 1;
+  }
+  std::cout << "  => OK" << std::endl;
+  auto group = flatbuffers::GetRoot<cpplab::UserGroup>(buf.data);
+  std::cout << "# Group name: " << group->name()->str() << std::endl
+            << "# Users:" << std::endl;
+  for (const auto u : *(group->users())) {
+    std::cout << "# - " << u->name()->str() << std::endl;
+  }
 
-    std::cout << "Load json file: " << kFooGroupJsonPath << std::endl;
-    std::string group_data;
-    if (!flatbuffers::LoadFile(kFooGroupJsonPath, false, &group_data)) {
-      std::cout << "  => Failed..." << std::endl;
-      return 1;
-    }
-    std::cout << "  => OK" << std::endl;
-    std::cout << "Parse json data" << std::endl;
-    parser.SetRootType("UserGroup");
-    if (!parser.Parse(group_data.c_str())) {
-      std::cout << "  => Failed..." << std::endl
-                << "JSON data:" << std::endl
-                << "===" << std::endl
-                << group_data << std::endl
-                << "===" << std::endl;
-    }
-    std::cout << "  => OK" << std::endl;
-    auto group = flatbuffers::GetRoot<cpplab::UserGroup>(
-        parser.builder_.GetBufferPointer());
-    std::cout << "# Group name: " << group->name()->str() << std::endl
-              << "# Users:" << std::endl;
-    for (const auto u : *(group->users())) {
-      std::cout << "# - " << u->name()->str() << std::endl;
-    }
+  std::cout << "Convert " << kBenchDocuments << " users" << std::endl;
+  auto start = std::chrono::steady_clock::now();
+  size_t bytes = 0;
+  for (int i = 0; i < kBenchDocuments; i++) {
+    bytes += user_converter.Convert(user_data).size;
   }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cout << "  => " << kBenchDocuments / seconds << " docs/s, " << bytes
+            << " bytes" << std::endl;
 
   return 0;
 }
@@ -0,0 +1,142 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "flatbuffers/flatbuffers.h"
+#include "gflags/gflags.h"
+
+#include "cpplab_generated.h"
+#include "record_store.h"
+
+DEFINE_string(log, "users.log", "Log of size-prefixed User buffers.");
+DEFINE_string(index, "", "Index file. Defaults to --log with \".idx\".");
+DEFINE_int32(count, 1000000, "Users appended by generate.");
+DEFINE_string(name, "", "User looked up by get.");
+DEFINE_int32(lookups, 1000000, "Lookups made by bench.");
+
+using Clock = std::chrono::steady_clock;
+using UserWriter = record_store::Writer<cpplab::User>;
+using UserReader = record_store::Reader<cpplab::User>;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string IndexPath() {
+  return FLAGS_index.empty() ? FLAGS_log + ".idx" : FLAGS_index;
+}
+
+// Appends FLAGS_count users named user<n> and updates the index.
+int Generate() {
+  const char *kLocations[] = {"Tokyo", "Osaka", "Kyoto", "Sapporo"};
+  UserWriter writer(&cpplab::User::name);
+  if (!writer.Open(FLAGS_log, IndexPath())) {
+    std::cout << writer.error() << std::endl;
+    return 1;
+  }
+  flatbuffers::FlatBufferBuilder fbb(1024);
+  for (int i = 0; i < FLAGS_count; i++) {
+    fbb.Clear();
+    std::string name = "user" + std::to_string(writer.size());
+    fbb.FinishSizePrefixed(
+        cpplab::CreateUserDirect(fbb, name.c_str(), kLocations[i % 4]));
+    if (!writer.Append(fbb.GetBufferPointer(), fbb.GetSize())) {
+      std::cout << writer.error() << std::endl;
+      return 1;
+    }
+  }
+  if (!writer.Close()) {
+    std::cout << writer.error() << std::endl;
+    return 1;
+  }
+  std::cout << "records: " << writer.size() << std::endl;
+  return 0;
+}
+
+// (Re)builds the index of FLAGS_log, e.g. one written by flatbuffers-ndjson.
+int Index() {
+  auto start = Clock::now();
+  UserWriter writer(&cpplab::User::name);
+  if (!writer.Open(FLAGS_log, IndexPath(), true) || !writer.Close()) {
+    std::cout << writer.error() << std::endl;
+    return 1;
+  }
+  std::cout << "records: " << writer.size() << ", elapsed: "
+            << SecondsSince(start) << "s" << std::endl;
+  return 0;
+}
+
+int Get() {
+  UserReader reader(&cpplab::User::name);
+  if (!reader.Open(FLAGS_log, IndexPath())) {
+    std::cout << reader.error() << std::endl;
+    return 1;
+  }
+  const cpplab::User *user = reader.Find(FLAGS_name);
+  if (user == nullptr) {
+    std::cout << "Not found: " << FLAGS_name << std::endl;
+    return 1;
+  }
+  std::cout << "# User name: " << user->name()->str() << std::endl
+            << "# Location: "
+            << (user->location() != nullptr ? user->location()->str() : "")
+            << std::endl;
+  return 0;
+}
+
+// Looks up FLAGS_lookups names of random records.
+int Bench() {
+  auto start = Clock::now();
+  UserReader reader(&cpplab::User::name);
+  if (!reader.Open(FLAGS_log, IndexPath())) {
+    std::cout << reader.error() << std::endl;
+    return 1;
+  }
+  double open_seconds = SecondsSince(start);
+  if (reader.size() == 0) {
+    std::cout << "No records." << std::endl;
+    return 1;
+  }
+
+  std::mt19937_64 rng(1);
+  std::uniform_int_distribution<size_t> dist(0, reader.size() - 1);
+  std::vector<std::string> names;
+  names.reserve(FLAGS_lookups);
+  for (int i = 0; i < FLAGS_lookups; i++) {
+    names.push_back(reader.Get(dist(rng))->name()->str());
+  }
+
+  start = Clock::now();
+  int found = 0;
+  for (auto &name : names) {
+    found += reader.Find(name) != nullptr;
+  }
+  double seconds = SecondsSince(start);
+  std::cout << "records: " << reader.size() << ", open: " << open_seconds * 1e6
+            << "us" << std::endl
+            << "lookups: " << found << "/" << names.size() << " found, "
+            << names.size() / seconds << " lookups/s" << std::endl;
+  return found == FLAGS_lookups ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  gflags::SetUsageMessage(
+      "Memory-mapped store of cpplab::User records.\n"
+      "Usage: flatbuffers-record-store generate|index|get|bench [flags]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::string command = argc > 1 ? argv[1] : "";
+  if (command == "generate") {
+    return Generate();
+  } else if (command == "index") {
+    return Index();
+  } else if (command == "get") {
+    return Get();
+  } else if (command == "bench") {
+    return Bench();
+  }
+  std::cout << "Unknown command: " << command << std::endl;
+  return 1;
+}
@@ -0,0 +1,329 @@
+#ifndef RECORD_STORE_H_
+#define RECORD_STORE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flatbuffers/flatbuffers.h"
+
+#include "mapped_file.h"
+
+// A store of FlatBuffers records of root type T, made of two files:
+//
+// - the log, size-prefixed buffers one after another, the same format
+//   flatbuffers-ndjson writes, and
+// - the index, a header, the offset of every record in the log, and an
+//   open-addressing hash table from a string key of the record (e.g.
+//   User.name) to its number.
+//
+// The reader maps both files and hands out tables straight from the log
+// mapping, so opening a store costs the same whatever its size and a lookup
+// touches one hash slot and the record itself. Files are in host byte order
+// and are trusted; records are not verified on read.
+namespace record_store {
+
+struct IndexHeader {
+  char magic[8];
+  uint64_t num_records;
+  // Bytes of the log covered by the index. Records appended to the log
+  // afterwards are not visible until the index is rebuilt.
+  uint64_t log_size;
+  // A power of two, at least twice num_records.
+  uint64_t num_slots;
+};
+
+struct IndexSlot {
+  uint64_t hash;
+  // Record number + 1; 0 marks an empty slot.
+  uint64_t record;
+};
+
+const char kIndexMagic[8] = {'C', 'P', 'L', 'I', 'D', 'X', '1', '\0'};
+
+// FNV-1a.
+inline uint64_t HashKey(const char *s, size_t size) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ static_cast<unsigned char>(s[i])) * 1099511628211ULL;
+  }
+  return h;
+}
+
+inline uint64_t NumSlots(uint64_t num_records) {
+  uint64_t n = 1;
+  while (n < num_records * 2) {
+    n <<= 1;
+  }
+  return n;
+}
+
+// Returns why [data, data + size) is not a complete index, or null if it is.
+inline const char *IndexProblem(const char *data, size_t size) {
+  if (size < sizeof(IndexHeader)) {
+    return " is too small.";
+  }
+  auto header = reinterpret_cast<const IndexHeader *>(data);
+  if (std::memcmp(header->magic, kIndexMagic, sizeof(kIndexMagic)) != 0) {
+    return " is not an index.";
+  }
+  if (size != sizeof(IndexHeader) + header->num_records * sizeof(uint64_t) +
+                  header->num_slots * sizeof(IndexSlot)) {
+    return " is truncated.";
+  }
+  return nullptr;
+}
+
+template <typename T>
+using KeyFunc = const flatbuffers::String *(T::*)() const;
+
+// Appends records to a log and writes its index on Close().
+//
+// Open() takes over the existing index and then indexes the records the log
+// has beyond it, so appending to a large store only reads the index and the
+// new tail of the log. Without a usable index, or with |rebuild|, every
+// record is indexed again; a log written by another tool therefore gets an
+// index by opening and closing a writer on it.
+template <typename T>
+class Writer {
+ public:
+  explicit Writer(KeyFunc<T> key)
+      : key_(key), log_(nullptr, fclose), size_(0), index_current_(false) {}
+
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+
+  bool Open(const std::string &log_path, const std::string &index_path,
+            bool rebuild = false) {
+    index_path_ = index_path;
+    MappedFile existing;
+    if (existing.Open(log_path, true)) {
+      if (!rebuild) {
+        LoadIndex(existing);
+      }
+      const char *data = existing.data();
+      while (size_ + sizeof(uint32_t) <= existing.size()) {
+        uint32_t size = flatbuffers::ReadScalar<uint32_t>(data + size_);
+        if (size_ + sizeof(uint32_t) + size > existing.size()) {
+          break;
+        }
+        Add(reinterpret_cast<const uint8_t *>(data + size_));
+        size_ += sizeof(uint32_t) + size;
+      }
+      if (size_ != existing.size()) {
+        return Fail(log_path + " ends with a partial record.");
+      }
+    }
+    log_.reset(fopen(log_path.c_str(), "ab"));
+    if (!log_) {
+      return Fail("Failed to open " + log_path);
+    }
+    return true;
+  }
+
+  // Appends |buf|, a size-prefixed buffer, e.g. from FinishSizePrefixed().
+  bool Append(const uint8_t *buf, size_t size) {
+    if (fwrite(buf, 1, size, log_.get()) != size) {
+      return Fail("Failed to write the log.");
+    }
+    Add(buf);
+    size_ += size;
+    return true;
+  }
+
+  // Flushes the log and replaces the index file, unless it is up to date.
+  bool Close() {
+    if (!log_ || fclose(log_.release()) != 0) {
+      return Fail("Failed to write the log.");
+    }
+    if (index_current_) {
+      return true;
+    }
+    IndexHeader header;
+    std::memcpy(header.magic, kIndexMagic, sizeof(header.magic));
+    header.num_records = offsets_.size();
+    header.log_size = size_;
+    header.num_slots = NumSlots(offsets_.size());
+    std::vector<IndexSlot> slots(header.num_slots, IndexSlot{0, 0});
+    for (size_t i = 0; i < hashes_.size(); i++) {
+      uint64_t s = hashes_[i] & (header.num_slots - 1);
+      while (slots[s].record != 0) {
+        s = (s + 1) & (header.num_slots - 1);
+      }
+      slots[s] = IndexSlot{hashes_[i], i + 1};
+    }
+
+    // Written aside and renamed, so readers never see a partial index.
+    std::string tmp_path = index_path_ + ".tmp";
+    std::unique_ptr<FILE, decltype(&fclose)> fp(
+        fopen(tmp_path.c_str(), "wb"), fclose);
+    if (!fp) {
+      return Fail("Failed to open " + tmp_path);
+    }
+    bool ok =
+        fwrite(&header, sizeof(header), 1, fp.get()) == 1 &&
+        fwrite(offsets_.data(), sizeof(uint64_t), offsets_.size(),
+               fp.get()) == offsets_.size() &&
+        fwrite(slots.data(), sizeof(IndexSlot), slots.size(), fp.get()) ==
+            slots.size();
+    if (fclose(fp.release()) != 0 || !ok) {
+      return Fail("Failed to write " + tmp_path);
+    }
+    if (std::rename(tmp_path.c_str(), index_path_.c_str()) != 0) {
+      return Fail("Failed to rename " + tmp_path);
+    }
+    return true;
+  }
+
+  size_t size() const { return offsets_.size(); }
+
+  const std::string &error() const { return error_; }
+
+ private:
+  void Add(const uint8_t *buf) {
+    const flatbuffers::String *key =
+        (flatbuffers::GetSizePrefixedRoot<T>(buf)->*key_)();
+    offsets_.push_back(size_);
+    hashes_.push_back(key != nullptr ? HashKey(key->c_str(), key->size()) : 0);
+    index_current_ = false;
+  }
+
+  // Takes over the records of the index at index_path_ if it is complete
+  // and its last record ends where it says the log did, within |log|.
+  // Otherwise the writer starts from an empty index.
+  void LoadIndex(const MappedFile &log) {
+    MappedFile index;
+    if (!index.Open(index_path_, true) ||
+        IndexProblem(index.data(), index.size()) != nullptr) {
+      return;
+    }
+    auto header = reinterpret_cast<const IndexHeader *>(index.data());
+    auto offsets = reinterpret_cast<const uint64_t *>(header + 1);
+    auto slots =
+        reinterpret_cast<const IndexSlot *>(offsets + header->num_records);
+    if (header->log_size > log.size()) {
+      return;
+    }
+    uint64_t end = 0;
+    if (header->num_records > 0) {
+      uint64_t last = offsets[header->num_records - 1];
+      if (last + sizeof(uint32_t) > header->log_size) {
+        return;
+      }
+      end = last + sizeof(uint32_t) +
+            flatbuffers::ReadScalar<uint32_t>(log.data() + last);
+    }
+    if (end != header->log_size) {
+      return;
+    }
+    offsets_.assign(offsets, offsets + header->num_records);
+    // The hashes are only kept in the table, next to their record number.
+    hashes_.assign(header->num_records, 0);
+    for (uint64_t i = 0; i < header->num_slots; i++) {
+      if (slots[i].record != 0) {
+        hashes_[slots[i].record - 1] = slots[i].hash;
+      }
+    }
+    size_ = header->log_size;
+    index_current_ = true;
+  }
+
+  bool Fail(const std::string &error) {
+    error_ = error;
+    return false;
+  }
+
+  KeyFunc<T> key_;
+  std::unique_ptr<FILE, decltype(&fclose)> log_;
+  std::string index_path_;
+  uint64_t size_;
+  std::vector<uint64_t> offsets_;
+  std::vector<uint64_t> hashes_;
+  // Whether the index file already matches offsets_ and hashes_.
+  bool index_current_;
+  std::string error_;
+};
+
+template <typename T>
+class Reader {
+ public:
+  explicit Reader(KeyFunc<T> key)
+      : key_(key), header_(nullptr), offsets_(nullptr), slots_(nullptr) {}
+
+  Reader(const Reader &) = delete;
+  Reader &operator=(const Reader &) = delete;
+
+  bool Open(const std::string &log_path, const std::string &index_path) {
+    // Random access, so no read-ahead.
+    if (!log_.Open(log_path, false)) {
+      return Fail(log_.error());
+    }
+    if (!index_.Open(index_path, false)) {
+      return Fail(index_.error());
+    }
+    const char *problem = IndexProblem(index_.data(), index_.size());
+    if (problem != nullptr) {
+      return Fail(index_path + problem);
+    }
+    auto header = reinterpret_cast<const IndexHeader *>(index_.data());
+    if (header->log_size > log_.size()) {
+      return Fail(index_path + " does not match " + log_path);
+    }
+    header_ = header;
+    offsets_ = reinterpret_cast<const uint64_t *>(header + 1);
+    slots_ =
+        reinterpret_cast<const IndexSlot *>(offsets_ + header->num_records);
+    return true;
+  }
+
+  size_t size() const { return header_ != nullptr ? header_->num_records : 0; }
+
+  // Returns record |i| in [0, size()).
+  const T *Get(size_t i) const {
+    return flatbuffers::GetSizePrefixedRoot<T>(log_.data() + offsets_[i]);
+  }
+
+  // Returns the first record whose key is |key|, or null.
+  const T *Find(const std::string &key) const {
+    if (header_ == nullptr) {
+      return nullptr;
+    }
+    uint64_t hash = HashKey(key.data(), key.size());
+    uint64_t mask = header_->num_slots - 1;
+    for (uint64_t s = hash & mask; slots_[s].record != 0; s = (s + 1) & mask) {
+      if (slots_[s].hash != hash) {
+        continue;
+      }
+      const T *record = Get(slots_[s].record - 1);
+      const flatbuffers::String *k = (record->*key_)();
+      if (k != nullptr && k->size() == key.size() &&
+          std::memcmp(k->c_str(), key.data(), key.size()) == 0) {
+        return record;
+      }
+    }
+    return nullptr;
+  }
+
+  const std::string &error() const { return error_; }
+
+ private:
+  bool Fail(const std::string &error) {
+    error_ = error;
+    return false;
+  }
+
+  KeyFunc<T> key_;
+  MappedFile log_;
+  MappedFile index_;
+  const IndexHeader *header_;
+  const uint64_t *offsets_;
+  const IndexSlot *slots_;
+  std::string error_;
+};
+
+}  // namespace record_store
+
+#endif  // RECORD_STORE_H_
@@ -0,0 +1,354 @@
+#ifndef NATS_CONNECTION_H_
+#define NATS_CONNECTION_H_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nats/adapters/libuv.h"
+#include "nats/nats.h"
+#include "uv.h"
+
+#include "nats_flusher.h"
+#include "nats_message.h"
+#include "nats_requester.h"
+#include "nats_subscription.h"
+
+namespace nats {
+
+// How publishes reach the socket.
+enum class FlushPolicy {
+  // Publishes are coalesced in cnats's outgoing buffer (Config::io_buf_size)
+  // and written by its flusher thread, so bursts go out in large writes.
+  kBuffered,
+  // Every publish is written right away; lowest latency, most syscalls.
+  kImmediate,
+  // Like kBuffered, but completions of PublishAsync()/FlushAsync() share one
+  // server round trip per Config::flush_interval_ms instead of one per
+  // burst.
+  kPeriodic,
+};
+
+// A message for Connection::PublishMany(). Nothing is copied; both pointers
+// only need to stay valid during the call.
+struct OutMessage {
+  const char *subject;
+  DataView data;
+};
+
+struct Reply {
+  natsStatus status;
+  Message msg;
+};
+
+// |sub| is null for errors that are not about one subscription.
+using OnErrorFunc = std::function<void(
+    natsStatus status, const std::shared_ptr<Subscription> &sub)>;
+
+class Connection {
+ public:
+  struct Config {
+    std::string url;
+    // Outgoing buffer size in bytes. 0 keeps the cnats default.
+    int io_buf_size;
+    FlushPolicy flush_policy;
+    int flush_interval_ms;
+    // Asynchronous errors, called on a cnats thread. Slow consumers go to
+    // SubscribeOptions::on_slow_consumer first if it is set.
+    OnErrorFunc on_error;
+  };
+
+  static Config DefaultConfig() {
+    return {NATS_DEFAULT_URL, 0, FlushPolicy::kBuffered, 0, nullptr};
+  }
+
+  Connection(const Config &config) : Connection(config, nullptr) {}
+
+  Connection(const Config &config, uv_loop_t *loop)
+      : nats_status_(NATS_OK),
+        opts_(),
+        conn_(),
+        on_error_(config.on_error) {
+    if (loop != nullptr) {
+      // The loop reads for cnats, so it counts as a cnats thread.
+      loop_thread_ = std::this_thread::get_id();
+      natsLibuv_Init();
+      natsLibuv_SetThreadLocalLoop(loop);
+    }
+
+    natsOptions *opts;
+    if (!MakeSureOfNatsOK(natsOptions_Create(&opts))) {
+      return;
+    }
+    opts_.reset(opts, natsOptions_Destroy);
+
+    if (loop != nullptr) {
+      if (!MakeSureOfNatsOK(natsOptions_SetEventLoop(
+              opts, static_cast<void *>(loop), natsLibuv_Attach, natsLibuv_Read,
+              natsLibuv_Write, natsLibuv_Detach))) {
+        return;
+      }
+    }
+
+    if (!MakeSureOfNatsOK(natsOptions_SetURL(opts, config.url.c_str()))) {
+      return;
+    }
+    if (config.io_buf_size > 0 &&
+        !MakeSureOfNatsOK(natsOptions_SetIOBufSize(opts, config.io_buf_size))) {
+      return;
+    }
+    if (config.flush_policy == FlushPolicy::kImmediate &&
+        !MakeSureOfNatsOK(natsOptions_SetSendAsap(opts, true))) {
+      return;
+    }
+    if (!MakeSureOfNatsOK(natsOptions_SetErrorHandler(opts, OnError, this))) {
+      return;
+    }
+
+    natsConnection *conn;
+    if (!MakeSureOfNatsOK(natsConnection_Connect(&conn, opts))) {
+      return;
+    }
+    conn_.reset(conn, natsConnection_Destroy);
+    if (loop != nullptr) {
+      requester_.reset(new Requester(conn, loop));
+      if (!MakeSureOfNatsOK(requester_->status())) {
+        return;
+      }
+    }
+    flusher_.reset(new Flusher(
+        conn, config.flush_policy == FlushPolicy::kPeriodic
+                  ? config.flush_interval_ms
+                  : 0));
+  }
+
+  ~Connection() {
+    requester_.reset();
+    // A flush in progress waits for the server's answer, which this thread
+    // may be the one to deliver, so it would only end after
+    // Flusher::kFlushTimeoutMs. Closing the connection ends it right away,
+    // with NATS_CONNECTION_CLOSED.
+    if (flusher_ && (CnatsCallbackScope::Active() ||
+                     std::this_thread::get_id() == loop_thread_)) {
+      natsConnection_Close(conn_.get());
+    }
+    flusher_.reset();
+    opts_.reset();
+    {
+      std::lock_guard<std::mutex> lock(subs_mutex_);
+      subs_.clear();
+    }
+    conn_.reset();
+  }
+
+  // Both report the status of the last call, from whichever thread made it.
+  explicit operator bool() const { return nats_status_.load() == NATS_OK; }
+
+  std::string error() { return natsStatus_GetText(nats_status_.load()); }
+
+  // |on_msg| is called on a cnats delivery thread, or on a worker of
+  // SubscribeOptions::pool. Subscribing and unsubscribing never block or
+  // race with message delivery.
+  std::shared_ptr<Subscription> Subscribe(const std::string &subject,
+                                          const OnMessageFunc &on_msg) {
+    return Subscribe(subject, on_msg, DefaultSubscribeOptions());
+  }
+
+  std::shared_ptr<Subscription> Subscribe(const std::string &subject,
+                                          const OnMessageFunc &on_msg,
+                                          const SubscribeOptions &options) {
+    auto dispatcher =
+        std::make_shared<Dispatcher>(on_msg, options.measure_latency);
+    natsSubscription *sub;
+    if (!MakeSureOfNatsOK(SubscribeWithContext(&sub, conn_.get(), subject,
+                                               dispatcher, options))) {
+      return nullptr;
+    }
+    auto nsub = std::make_shared<Subscription>(sub, dispatcher,
+                                               options.on_slow_consumer);
+    std::lock_guard<std::mutex> lock(subs_mutex_);
+    subs_.emplace_back(nsub);
+    return nsub;
+  }
+
+  // Joins the queue group |queue|, so that the group's members share the
+  // messages of |subject|.
+  std::shared_ptr<Subscription> QueueSubscribe(const std::string &subject,
+                                               const std::string &queue,
+                                               const OnMessageFunc &on_msg) {
+    SubscribeOptions options = DefaultSubscribeOptions();
+    options.queue = queue;
+    return Subscribe(subject, on_msg, options);
+  }
+
+  // The handler may still run for messages already being delivered when
+  // this returns.
+  bool Unsubscribe(const std::shared_ptr<Subscription> &sub) {
+    natsSubscription_Unsubscribe(sub->nats_sub());
+    std::lock_guard<std::mutex> lock(subs_mutex_);
+    subs_.erase(std::remove(subs_.begin(), subs_.end(), sub), subs_.end());
+    return true;
+  }
+
+  // Queues |data| for |subject|. It is sent according to the flush policy,
+  // so returning true does not mean the server has it yet.
+  bool Publish(const char *subject, DataView data) {
+    return MakeSureOfNatsOK(natsConnection_Publish(
+        conn_.get(), subject, data.data(), static_cast<int>(data.size())));
+  }
+
+  bool Publish(const std::string &subject, DataView data) {
+    return Publish(subject.c_str(), data);
+  }
+
+  bool PublishString(const std::string &subject, const std::string &msg) {
+    return Publish(subject, msg);
+  }
+
+  // Queues all |n| messages back to back, so that they share socket writes.
+  // Stops at the first failure and returns the number queued.
+  size_t PublishMany(const OutMessage *msgs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      if (!Publish(msgs[i].subject, msgs[i].data)) {
+        return i;
+      }
+    }
+    return n;
+  }
+
+  size_t PublishMany(const std::vector<OutMessage> &msgs) {
+    return PublishMany(msgs.data(), msgs.size());
+  }
+
+  // Like Publish(), and then calls |on_published| on the flusher thread once
+  // the server has processed the message, or with the error.
+  bool PublishAsync(const std::string &subject, DataView data,
+                    const OnFlushedFunc &on_published) {
+    if (!Publish(subject, data)) {
+      return false;
+    }
+    FlushAsync(on_published);
+    return true;
+  }
+
+  // Calls |on_flushed| on the flusher thread once everything published so
+  // far has been processed by the server.
+  void FlushAsync(const OnFlushedFunc &on_flushed) {
+    if (!flusher_) {
+      on_flushed(NATS_CONNECTION_CLOSED);
+      return;
+    }
+    flusher_->Add(on_flushed);
+  }
+
+  // Sends a request and calls |on_reply| with the reply, or with
+  // NATS_TIMEOUT if none comes within |timeout_ms|; see Requester for the
+  // threads it may run on. Needs a connection on a uv loop.
+  bool Request(const std::string &subject, DataView data, int64_t timeout_ms,
+               const OnReplyFunc &on_reply) {
+    return MakeSureOfNatsOK(StartRequest(subject, data, timeout_ms, on_reply));
+  }
+
+  // Same as above, with the result delivered through a future. Do not wait
+  // for it on the loop thread, which is needed to expire the timeout.
+  std::future<Reply> Request(const std::string &subject, DataView data,
+                             int64_t timeout_ms) {
+    auto pending = std::make_shared<PendingReply>();
+    std::future<Reply> future = pending->promise.get_future();
+    natsStatus status = StartRequest(
+        subject, data, timeout_ms, [pending](natsStatus status, Message msg) {
+          pending->Set(status, std::move(msg));
+        });
+    if (!MakeSureOfNatsOK(status)) {
+      pending->Set(status, Message());
+    }
+    return future;
+  }
+
+  // Sends |data| to the reply subject of |request|.
+  bool Respond(const Message &request, DataView data) {
+    if (request.reply() == nullptr) {
+      return MakeSureOfNatsOK(NATS_INVALID_SUBJECT);
+    }
+    return Publish(request.reply(), data);
+  }
+
+  // Blocks until everything published so far has been processed by the
+  // server. On a uv loop this must not be called from the loop thread, which
+  // is the one that reads the server's answer.
+  bool Flush(int64_t timeout_ms) {
+    return MakeSureOfNatsOK(
+        natsConnection_FlushTimeout(conn_.get(), timeout_ms));
+  }
+
+ private:
+  // The promise of a future Request(). Only the first result is kept.
+  struct PendingReply {
+    PendingReply() : done(false) {}
+
+    void Set(natsStatus status, Message msg) {
+      if (!done.exchange(true)) {
+        promise.set_value(Reply{status, std::move(msg)});
+      }
+    }
+
+    std::promise<Reply> promise;
+    std::atomic<bool> done;
+  };
+
+  natsStatus StartRequest(const std::string &subject, DataView data,
+                          int64_t timeout_ms, const OnReplyFunc &on_reply) {
+    if (!requester_) {
+      return NATS_ILLEGAL_STATE;
+    }
+    return requester_->Request(subject, data, timeout_ms, on_reply);
+  }
+
+  static void OnError(natsConnection *nc, natsSubscription *nsub,
+                      natsStatus err, void *closure) {
+    CnatsCallbackScope scope;
+    auto self = static_cast<Connection *>(closure);
+    std::shared_ptr<Subscription> sub;
+    if (nsub != nullptr) {
+      std::lock_guard<std::mutex> lock(self->subs_mutex_);
+      for (const auto &s : self->subs_) {
+        if (s->nats_sub() == nsub) {
+          sub = s;
+          break;
+        }
+      }
+    }
+    if (err == NATS_SLOW_CONSUMER && sub && sub->on_slow_consumer()) {
+      sub->on_slow_consumer()(*sub);
+    } else if (self->on_error_) {
+      self->on_error_(err, sub);
+    }
+  }
+
+  // Called from any thread that publishes, so the status is atomic.
+  bool MakeSureOfNatsOK(natsStatus status) {
+    nats_status_.store(status);
+    return status == NATS_OK;
+  }
+
+  std::atomic<natsStatus> nats_status_;
+  std::shared_ptr<natsOptions> opts_;
+  std::shared_ptr<natsConnection> conn_;
+  OnErrorFunc on_error_;
+  // Default-constructed, i.e. no thread, without a loop.
+  std::thread::id loop_thread_;
+  std::unique_ptr<Requester> requester_;
+  std::unique_ptr<Flusher> flusher_;
+  std::mutex subs_mutex_;
+  std::vector<std::shared_ptr<Subscription>> subs_;
+};
+
+}  // namespace nats
+
+#endif  // NATS_CONNECTION_H_
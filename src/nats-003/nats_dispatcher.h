@@ -0,0 +1,84 @@
+#ifndef NATS_DISPATCHER_H_
+#define NATS_DISPATCHER_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "nats_message.h"
+
+namespace nats {
+
+// Calls a subscription's handler and optionally records the dispatch
+// latency of every message: the time from the cnats callback to the end of
+// the handler, which includes any time spent queued on a WorkerPool.
+//
+// Each thread records into its own histogram slot, so measuring does not
+// make the delivery and worker threads contend on one lock; latency() merges
+// the slots. Threads only share a slot when there are more than kSlots.
+class Dispatcher {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  Dispatcher(const OnMessageFunc &on_msg, bool measure_latency)
+      : on_msg_(on_msg), measure_latency_(measure_latency) {
+    for (int i = 0; measure_latency_ && i < kSlots; i++) {
+      slots_.emplace_back(new Slot());
+    }
+  }
+
+  // |received| is when cnats handed the message over; it is only read if
+  // measure_latency() is true.
+  void Dispatch(Message msg, Clock::time_point received) {
+    on_msg_(std::move(msg));
+    if (measure_latency_) {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - received)
+                    .count();
+      Slot &slot = *slots_[ThreadIndex() % kSlots];
+      std::lock_guard<std::mutex> lock(slot.mutex);
+      slot.latency.Record(us);
+    }
+  }
+
+  bool measure_latency() const { return measure_latency_; }
+
+  // Returns a snapshot of the latencies in microseconds.
+  LatencyHistogram latency() {
+    LatencyHistogram merged;
+    for (auto &slot : slots_) {
+      std::lock_guard<std::mutex> lock(slot->mutex);
+      merged.Merge(slot->latency);
+    }
+    return merged;
+  }
+
+ private:
+  static const int kSlots = 16;
+
+  // Allocated one by one and padded so that two slots never share a cache
+  // line. The mutex is only contended while latency() reads the slot.
+  struct Slot {
+    std::mutex mutex;
+    LatencyHistogram latency;
+    char padding[64];
+  };
+
+  // A small number that is fixed for the calling thread.
+  static unsigned ThreadIndex() {
+    static std::atomic<unsigned> next(0);
+    static thread_local unsigned index = next++;
+    return index;
+  }
+
+  OnMessageFunc on_msg_;
+  bool measure_latency_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+};
+
+}  // namespace nats
+
+#endif  // NATS_DISPATCHER_H_
@@ -0,0 +1,98 @@
+#ifndef NATS_FLATBUFFERS_H_
+#define NATS_FLATBUFFERS_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "flatbuffers/flatbuffers.h"
+
+#include "nats_connection.h"
+#include "nats_message.h"
+#include "nats_subscription.h"
+
+// Typed publish/subscribe of FlatBuffers tables over nats::Connection.
+//
+// Messages are plain FlatBuffers of root type T, with no size prefix or
+// file identifier, so anything that can read a T can read the payload.
+namespace nats {
+namespace fbs {
+
+// A received message and the root table of its payload. The table points
+// into the natsMsg data, so it is only valid while the Table is alive.
+template <typename T>
+class Table {
+ public:
+  Table() : root_(nullptr) {}
+
+  // Verifies the payload of |msg|; root() is null if it is not a valid T.
+  explicit Table(Message msg) : msg_(std::move(msg)), root_(nullptr) {
+    DataView data = msg_.data();
+    auto buf = reinterpret_cast<const uint8_t *>(data.data());
+    flatbuffers::Verifier verifier(buf, data.size());
+    if (buf != nullptr && verifier.VerifyBuffer<T>(nullptr)) {
+      root_ = flatbuffers::GetRoot<T>(buf);
+    }
+  }
+
+  explicit operator bool() const { return root_ != nullptr; }
+
+  const T *root() const { return root_; }
+  const T *operator->() const { return root_; }
+
+  const Message &message() const { return msg_; }
+
+ private:
+  Message msg_;
+  const T *root_;
+};
+
+template <typename T>
+using BuildFunc =
+    std::function<flatbuffers::Offset<T>(flatbuffers::FlatBufferBuilder &fbb)>;
+
+template <typename T>
+using OnTableFunc = std::function<void(Table<T> table)>;
+
+// Each thread keeps one builder and clears it between messages, so after the
+// first few messages a publish allocates nothing. cnats copies the payload
+// before Publish returns, so the buffer can be reused right away.
+inline flatbuffers::FlatBufferBuilder &ThreadLocalBuilder() {
+  static thread_local flatbuffers::FlatBufferBuilder fbb(1024);
+  fbb.Clear();
+  return fbb;
+}
+
+// Publishes the table |build| creates in the given builder.
+template <typename T>
+bool Publish(Connection &conn, const std::string &subject,
+             const BuildFunc<T> &build) {
+  flatbuffers::FlatBufferBuilder &fbb = ThreadLocalBuilder();
+  fbb.Finish(build(fbb));
+  return conn.Publish(subject, DataView(fbb.GetBufferPointer(), fbb.GetSize()));
+}
+
+// Subscribes |on_table| to |subject|. Messages whose payload fails
+// verification are passed on too, as a Table whose root() is null.
+template <typename T>
+std::shared_ptr<Subscription> Subscribe(Connection &conn,
+                                        const std::string &subject,
+                                        const OnTableFunc<T> &on_table,
+                                        const SubscribeOptions &options) {
+  return conn.Subscribe(
+      subject, [on_table](Message msg) { on_table(Table<T>(std::move(msg))); },
+      options);
+}
+
+template <typename T>
+std::shared_ptr<Subscription> Subscribe(Connection &conn,
+                                        const std::string &subject,
+                                        const OnTableFunc<T> &on_table) {
+  return Subscribe<T>(conn, subject, on_table, DefaultSubscribeOptions());
+}
+
+}  // namespace fbs
+}  // namespace nats
+
+#endif  // NATS_FLATBUFFERS_H_
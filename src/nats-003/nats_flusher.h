@@ -0,0 +1,103 @@
+#ifndef NATS_FLUSHER_H_
+#define NATS_FLUSHER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "nats/nats.h"
+
+namespace nats {
+
+using OnFlushedFunc = std::function<void(natsStatus status)>;
+
+// Confirms publishes off the caller's thread. Callbacks added with Add() are
+// completed by the next natsConnection_FlushTimeout, i.e. once the server
+// has answered a PING sent after their messages, and all callbacks that
+// arrived in the meantime share that one round trip.
+//
+// With |interval_ms| > 0, a flush starts one interval after the first
+// callback that is waiting, so that those added meanwhile share it, trading
+// completion latency for fewer round trips. Otherwise one starts as soon as
+// a callback is waiting. Either way the thread sleeps while none is.
+//
+// Callbacks run on the flusher thread. Those still waiting at destruction
+// get NATS_CONNECTION_CLOSED.
+class Flusher {
+ public:
+  static const int64_t kFlushTimeoutMs = 10000;
+
+  Flusher(natsConnection *conn, int interval_ms)
+      : conn_(conn), interval_ms_(interval_ms), stopping_(false) {
+    thread_ = std::thread([this]() { Run(); });
+  }
+
+  Flusher(const Flusher &) = delete;
+  Flusher &operator=(const Flusher &) = delete;
+
+  ~Flusher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  void Add(const OnFlushedFunc &on_flushed) {
+    bool first;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      first = pending_.empty();
+      pending_.push_back(on_flushed);
+    }
+    if (first) {
+      cv_.notify_one();
+    }
+  }
+
+ private:
+  void Run() {
+    std::vector<OnFlushedFunc> batch;
+    for (;;) {
+      bool stopping;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+        if (interval_ms_ > 0) {
+          cv_.wait_for(lock, std::chrono::milliseconds(interval_ms_),
+                       [this]() { return stopping_; });
+        }
+        stopping = stopping_;
+        batch.swap(pending_);
+      }
+      if (!batch.empty()) {
+        natsStatus status = stopping ? NATS_CONNECTION_CLOSED
+                                     : natsConnection_FlushTimeout(
+                                           conn_, kFlushTimeoutMs);
+        for (auto &on_flushed : batch) {
+          on_flushed(status);
+        }
+        batch.clear();
+      }
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+  natsConnection *conn_;
+  int interval_ms_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<OnFlushedFunc> pending_;
+  bool stopping_;
+  std::thread thread_;
+};
+
+}  // namespace nats
+
+#endif  // NATS_FLUSHER_H_
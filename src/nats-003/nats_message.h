@@ -0,0 +1,100 @@
+#ifndef NATS_MESSAGE_H_
+#define NATS_MESSAGE_H_
+
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "nats/nats.h"
+
+namespace nats {
+
+// Non-owning view of a byte range, like C++17's std::string_view. Payloads
+// are binary, so nothing here assumes a terminating NUL.
+class DataView {
+ public:
+  DataView() : data_(nullptr), size_(0) {}
+  DataView(const void *data, size_t size)
+      : data_(static_cast<const char *>(data)), size_(size) {}
+  DataView(const std::string &s) : data_(s.data()), size_(s.size()) {}
+  DataView(const char *s) : data_(s), size_(std::strlen(s)) {}
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const char *begin() const { return data_; }
+  const char *end() const { return data_ + size_; }
+  char operator[](size_t i) const { return data_[i]; }
+
+  std::string ToString() const { return std::string(data_, size_); }
+
+  bool operator==(const DataView &other) const {
+    return size_ == other.size_ &&
+           (size_ == 0 || std::memcmp(data_, other.data_, size_) == 0);
+  }
+  bool operator!=(const DataView &other) const { return !(*this == other); }
+
+ private:
+  const char *data_;
+  size_t size_;
+};
+
+// Owns one natsMsg. Move-only and a single pointer wide, so handing a
+// message to a handler allocates nothing on top of what cnats already did.
+class Message {
+ public:
+  Message() : msg_(nullptr) {}
+  explicit Message(natsMsg *msg) : msg_(msg) {}
+
+  Message(Message &&other) : msg_(other.msg_) { other.msg_ = nullptr; }
+
+  Message &operator=(Message &&other) {
+    if (this != &other) {
+      Reset(other.Release());
+    }
+    return *this;
+  }
+
+  Message(const Message &) = delete;
+  Message &operator=(const Message &) = delete;
+
+  ~Message() { Reset(nullptr); }
+
+  explicit operator bool() const { return msg_ != nullptr; }
+
+  const char *subject() const { return natsMsg_GetSubject(msg_); }
+
+  // Null if the message has no reply subject.
+  const char *reply() const { return natsMsg_GetReply(msg_); }
+
+  // Valid as long as this message is.
+  DataView data() const {
+    return DataView(natsMsg_GetData(msg_), natsMsg_GetDataLength(msg_));
+  }
+
+  natsMsg *nats_msg() const { return msg_; }
+
+  natsMsg *Release() {
+    natsMsg *msg = msg_;
+    msg_ = nullptr;
+    return msg;
+  }
+
+  void Reset(natsMsg *msg) {
+    if (msg_ != nullptr) {
+      natsMsg_Destroy(msg_);
+    }
+    msg_ = msg;
+  }
+
+ private:
+  natsMsg *msg_;
+};
+
+// Stored once per subscription, so calling it per message allocates nothing.
+using OnMessageFunc = std::function<void(Message msg)>;
+
+}  // namespace nats
+
+#endif  // NATS_MESSAGE_H_
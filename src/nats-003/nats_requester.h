@@ -0,0 +1,231 @@
+#ifndef NATS_REQUESTER_H_
+#define NATS_REQUESTER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "nats/nats.h"
+#include "uv.h"
+
+#include "nats_message.h"
+#include "nats_subscription.h"
+
+namespace nats {
+
+// |reply| is empty unless |status| is NATS_OK.
+using OnReplyFunc = std::function<void(natsStatus status, Message reply)>;
+
+// Request/reply over a single wildcard inbox subscription.
+//
+// Every request gets a reply subject "<inbox>.<token>" under one
+// "<inbox>.*" subscription, and replies are matched to requests by token,
+// so in-flight requests cost a map entry rather than a subscription each.
+// Timeouts are expired by one uv timer armed for the earliest deadline.
+//
+// A reply completes its request on the cnats delivery thread, a timeout on
+// the loop thread; each request completes exactly once. Request() may be
+// called from any thread, but the Requester must be created and destroyed
+// on the loop thread.
+class Requester {
+ public:
+  Requester(natsConnection *conn, uv_loop_t *loop)
+      : conn_(conn),
+        state_(std::make_shared<State>()),
+        sub_(nullptr, natsSubscription_Destroy),
+        timer_(new uv_timer_t),
+        async_(new uv_async_t),
+        loop_thread_(std::this_thread::get_id()),
+        next_token_(0),
+        status_(NATS_OK) {
+    uv_timer_init(loop, timer_);
+    timer_->data = this;
+    uv_async_init(loop, async_, OnAsync);
+    async_->data = this;
+    // Only an armed timer, i.e. a pending request, keeps the loop alive.
+    uv_unref(reinterpret_cast<uv_handle_t *>(async_));
+
+    natsInbox *inbox;
+    status_ = natsInbox_Create(&inbox);
+    if (status_ != NATS_OK) {
+      return;
+    }
+    prefix_ = std::string(inbox) + ".";
+    natsInbox_Destroy(inbox);
+
+    std::shared_ptr<State> state = state_;
+    natsSubscription *sub;
+    status_ = SubscribeWithContext(
+        &sub, conn_, prefix_ + "*",
+        std::make_shared<Dispatcher>(
+            [state](Message msg) { state->OnReply(std::move(msg)); }, false),
+        DefaultSubscribeOptions());
+    if (status_ == NATS_OK) {
+      sub_.reset(sub);
+    }
+  }
+
+  Requester(const Requester &) = delete;
+  Requester &operator=(const Requester &) = delete;
+
+  ~Requester() {
+    sub_.reset();
+    for (auto &on_reply : state_->TakeAll()) {
+      on_reply(NATS_CONNECTION_CLOSED, Message());
+    }
+    uv_close(reinterpret_cast<uv_handle_t *>(timer_), [](uv_handle_t *h) {
+      delete reinterpret_cast<uv_timer_t *>(h);
+    });
+    uv_close(reinterpret_cast<uv_handle_t *>(async_), [](uv_handle_t *h) {
+      delete reinterpret_cast<uv_async_t *>(h);
+    });
+  }
+
+  natsStatus status() const { return status_; }
+
+  natsStatus Request(const std::string &subject, DataView data,
+                     int64_t timeout_ms, const OnReplyFunc &on_reply) {
+    if (status_ != NATS_OK) {
+      return status_;
+    }
+    uint64_t token = next_token_++;
+    std::string reply = prefix_ + std::to_string(token);
+    // Registered first, since the reply may come before Publish returns.
+    state_->Add(token, nats_Now() + timeout_ms, on_reply);
+    natsStatus status = natsConnection_PublishRequest(
+        conn_, subject.c_str(), reply.c_str(), data.data(),
+        static_cast<int>(data.size()));
+    if (status != NATS_OK) {
+      // If the request has already timed out, its callback has reported
+      // that, and reporting the failure too would complete it twice.
+      return state_->Take(token) ? status : NATS_OK;
+    }
+    if (std::this_thread::get_id() == loop_thread_) {
+      Expire();
+    } else {
+      // The timer can only be touched on the loop thread.
+      uv_async_send(async_);
+    }
+    return NATS_OK;
+  }
+
+ private:
+  class State {
+   public:
+    void Add(uint64_t token, int64_t deadline, const OnReplyFunc &on_reply) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.emplace(token, Pending{on_reply, deadline});
+      deadlines_.emplace(deadline, token);
+    }
+
+    // Removes the request and returns its callback, or an empty one if it
+    // has already completed.
+    OnReplyFunc Take(uint64_t token) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return TakeLocked(token);
+    }
+
+    std::vector<OnReplyFunc> TakeAll() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<OnReplyFunc> all;
+      for (auto &p : pending_) {
+        all.push_back(std::move(p.second.on_reply));
+      }
+      pending_.clear();
+      deadlines_.clear();
+      return all;
+    }
+
+    // Removes the requests due by |now|, and stores the earliest remaining
+    // deadline into |next|, or -1 if there is none.
+    std::vector<OnReplyFunc> TakeExpired(int64_t now, int64_t *next) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<OnReplyFunc> expired;
+      while (!deadlines_.empty() && deadlines_.begin()->first <= now) {
+        expired.push_back(TakeLocked(deadlines_.begin()->second));
+      }
+      *next = deadlines_.empty() ? -1 : deadlines_.begin()->first;
+      return expired;
+    }
+
+    void OnReply(Message msg) {
+      const char *subject = msg.subject();
+      const char *dot = std::strrchr(subject, '.');
+      if (dot == nullptr) {
+        return;
+      }
+      OnReplyFunc on_reply = Take(std::strtoull(dot + 1, nullptr, 10));
+      if (on_reply) {
+        on_reply(NATS_OK, std::move(msg));
+      }
+    }
+
+   private:
+    struct Pending {
+      OnReplyFunc on_reply;
+      int64_t deadline;
+    };
+
+    OnReplyFunc TakeLocked(uint64_t token) {
+      auto it = pending_.find(token);
+      if (it == pending_.end()) {
+        return nullptr;
+      }
+      OnReplyFunc on_reply = std::move(it->second.on_reply);
+      deadlines_.erase(std::make_pair(it->second.deadline, token));
+      pending_.erase(it);
+      return on_reply;
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, Pending> pending_;
+    std::set<std::pair<int64_t, uint64_t>> deadlines_;
+  };
+
+  // Expires due requests and rearms the timer for the next deadline.
+  void Expire() {
+    int64_t now = nats_Now();
+    int64_t next;
+    for (auto &on_reply : state_->TakeExpired(now, &next)) {
+      on_reply(NATS_TIMEOUT, Message());
+    }
+    if (next < 0) {
+      uv_timer_stop(timer_);
+    } else {
+      uv_timer_start(timer_, OnTimer, std::max<int64_t>(0, next - now), 0);
+    }
+  }
+
+  static void OnTimer(uv_timer_t *handle) {
+    static_cast<Requester *>(handle->data)->Expire();
+  }
+
+  static void OnAsync(uv_async_t *handle) {
+    static_cast<Requester *>(handle->data)->Expire();
+  }
+
+  natsConnection *conn_;
+  std::shared_ptr<State> state_;
+  std::unique_ptr<natsSubscription, decltype(&natsSubscription_Destroy)> sub_;
+  uv_timer_t *timer_;
+  uv_async_t *async_;
+  std::thread::id loop_thread_;
+  std::string prefix_;
+  std::atomic<uint64_t> next_token_;
+  natsStatus status_;
+};
+
+}  // namespace nats
+
+#endif  // NATS_REQUESTER_H_
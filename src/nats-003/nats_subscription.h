@@ -0,0 +1,207 @@
+#ifndef NATS_SUBSCRIPTION_H_
+#define NATS_SUBSCRIPTION_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "nats/nats.h"
+
+#include "latency_histogram.h"
+#include "nats_dispatcher.h"
+#include "nats_message.h"
+#include "nats_worker_pool.h"
+
+namespace nats {
+
+class Subscription;
+
+using OnSlowConsumerFunc = std::function<void(Subscription &sub)>;
+
+struct SubscribeOptions {
+  // Queue group name. Each message is delivered to only one member of the
+  // group. Empty for a plain subscription.
+  std::string queue;
+  // If set, the handler runs on this pool instead of the delivery thread.
+  std::shared_ptr<WorkerPool> pool;
+  // With |pool|, keeps the messages of each subject in order by running
+  // them on one worker. Otherwise any worker may run any message.
+  bool ordered_by_subject;
+  // Messages and bytes cnats buffers for the subscription before it drops
+  // messages and reports a slow consumer. 0 keeps the cnats default and a
+  // negative value means no limit.
+  int pending_msgs_limit;
+  int pending_bytes_limit;
+  // Called on a cnats thread when messages start being dropped because a
+  // pending limit was hit. Unset, the connection's on_error gets it.
+  OnSlowConsumerFunc on_slow_consumer;
+  // Records the dispatch latency of every message; see Dispatcher.
+  bool measure_latency;
+};
+
+inline SubscribeOptions DefaultSubscribeOptions() {
+  return {std::string(), nullptr, true, 0, 0, nullptr, false};
+}
+
+struct SubscriptionStats {
+  int pending_msgs;
+  int pending_bytes;
+  int max_pending_msgs;
+  int max_pending_bytes;
+  int64_t delivered_msgs;
+  int64_t dropped_msgs;
+  // In microseconds. Empty unless SubscribeOptions::measure_latency is set.
+  LatencyHistogram dispatch_latency;
+};
+
+// Marks the current thread as being inside a cnats callback while it lives.
+// Code that must not wait for cnats, such as ~Connection, checks Active().
+class CnatsCallbackScope {
+ public:
+  CnatsCallbackScope() : outer_(Flag()) { Flag() = true; }
+  ~CnatsCallbackScope() { Flag() = outer_; }
+
+  CnatsCallbackScope(const CnatsCallbackScope &) = delete;
+  CnatsCallbackScope &operator=(const CnatsCallbackScope &) = delete;
+
+  static bool Active() { return Flag(); }
+
+ private:
+  static bool &Flag() {
+    static thread_local bool flag = false;
+    return flag;
+  }
+
+  bool outer_;
+};
+
+// Per-subscription state that cnats hands back as the closure of every
+// message callback, so dispatching a message is a plain pointer dereference
+// with no shared table to look up or lock.
+//
+// cnats may still be delivering on its own threads after Unsubscribe(), so
+// the context is owned by cnats rather than by Subscription: it is deleted
+// in the on-complete callback, which runs after the last message callback.
+class SubscriptionContext {
+ public:
+  SubscriptionContext(const std::shared_ptr<Dispatcher> &dispatcher,
+                      const SubscribeOptions &options)
+      : dispatcher_(dispatcher),
+        pool_(options.pool),
+        ordered_(options.ordered_by_subject) {}
+
+  static void OnMessage(natsConnection *nc, natsSubscription *sub,
+                        natsMsg *msg, void *closure) {
+    CnatsCallbackScope scope;
+    auto ctx = static_cast<SubscriptionContext *>(closure);
+    Dispatcher::Clock::time_point received;
+    if (ctx->dispatcher_->measure_latency()) {
+      received = Dispatcher::Clock::now();
+    }
+    if (ctx->pool_) {
+      ctx->pool_->Submit(ctx->dispatcher_, Message(msg), ctx->ordered_,
+                         received);
+    } else {
+      ctx->dispatcher_->Dispatch(Message(msg), received);
+    }
+  }
+
+  static void OnComplete(void *closure) {
+    delete static_cast<SubscriptionContext *>(closure);
+  }
+
+ private:
+  // Shared with Subscription and with messages still queued on |pool_|.
+  std::shared_ptr<Dispatcher> dispatcher_;
+  std::shared_ptr<WorkerPool> pool_;
+  bool ordered_;
+};
+
+// Subscribes |dispatcher| to |subject| through a new SubscriptionContext and
+// hands the context over to cnats.
+inline natsStatus SubscribeWithContext(
+    natsSubscription **sub, natsConnection *conn, const std::string &subject,
+    const std::shared_ptr<Dispatcher> &dispatcher,
+    const SubscribeOptions &options) {
+  std::unique_ptr<SubscriptionContext> ctx(
+      new SubscriptionContext(dispatcher, options));
+  natsStatus status;
+  if (options.queue.empty()) {
+    status = natsConnection_Subscribe(sub, conn, subject.c_str(),
+                                      SubscriptionContext::OnMessage,
+                                      ctx.get());
+  } else {
+    status = natsConnection_QueueSubscribe(
+        sub, conn, subject.c_str(), options.queue.c_str(),
+        SubscriptionContext::OnMessage, ctx.get());
+  }
+  if (status != NATS_OK) {
+    return status;
+  }
+  status = natsSubscription_SetOnCompleteCB(
+      *sub, SubscriptionContext::OnComplete, ctx.get());
+  // On failure messages may already be in flight, so there is no safe point
+  // to free the context; leak it rather than risk a use after free.
+  ctx.release();
+  if (status == NATS_OK &&
+      (options.pending_msgs_limit != 0 || options.pending_bytes_limit != 0)) {
+    int msgs_limit, bytes_limit;
+    status = natsSubscription_GetPendingLimits(*sub, &msgs_limit, &bytes_limit);
+    if (status == NATS_OK) {
+      if (options.pending_msgs_limit != 0) {
+        msgs_limit = options.pending_msgs_limit;
+      }
+      if (options.pending_bytes_limit != 0) {
+        bytes_limit = options.pending_bytes_limit;
+      }
+      status = natsSubscription_SetPendingLimits(*sub, msgs_limit, bytes_limit);
+    }
+  }
+  if (status != NATS_OK) {
+    natsSubscription_Destroy(*sub);
+    *sub = nullptr;
+  }
+  return status;
+}
+
+class Subscription {
+ public:
+  Subscription(natsSubscription *sub) : Subscription(sub, nullptr, nullptr) {}
+
+  Subscription(natsSubscription *sub,
+               const std::shared_ptr<Dispatcher> &dispatcher,
+               const OnSlowConsumerFunc &on_slow_consumer)
+      : sub_(sub, natsSubscription_Destroy),
+        dispatcher_(dispatcher),
+        on_slow_consumer_(on_slow_consumer) {}
+
+  natsSubscription *nats_sub() const { return sub_.get(); }
+
+  const OnSlowConsumerFunc &on_slow_consumer() const {
+    return on_slow_consumer_;
+  }
+
+  // Safe to call from any thread, e.g. from on_slow_consumer to decide
+  // whether to shed load.
+  bool GetStats(SubscriptionStats *stats) const {
+    if (natsSubscription_GetStats(
+            sub_.get(), &stats->pending_msgs, &stats->pending_bytes,
+            &stats->max_pending_msgs, &stats->max_pending_bytes,
+            &stats->delivered_msgs, &stats->dropped_msgs) != NATS_OK) {
+      return false;
+    }
+    stats->dispatch_latency =
+        dispatcher_ ? dispatcher_->latency() : LatencyHistogram();
+    return true;
+  }
+
+ private:
+  std::shared_ptr<natsSubscription> sub_;
+  std::shared_ptr<Dispatcher> dispatcher_;
+  OnSlowConsumerFunc on_slow_consumer_;
+};
+
+}  // namespace nats
+
+#endif  // NATS_SUBSCRIPTION_H_
@@ -0,0 +1,214 @@
+#ifndef NATS_WORKER_POOL_H_
+#define NATS_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "nats_dispatcher.h"
+#include "nats_message.h"
+
+namespace nats {
+
+// Runs message handlers on a fixed set of threads, for subscriptions whose
+// handlers are too heavy for the cnats delivery thread.
+//
+// Every worker has two queues. Ordered messages are put on the queue of the
+// worker their subject hashes to and only that worker runs them, so messages
+// of one subject are handled one at a time and in order. Other messages go
+// to an idle worker, or round robin, and workers that run out of work steal
+// them from the back of the others' queues.
+//
+// At most |capacity| messages are queued; Submit() blocks beyond that, which
+// pushes back on the delivery thread and lets the subscription's pending
+// limits take over. Queued messages are still handled at destruction.
+class WorkerPool {
+ public:
+  WorkerPool(int num_threads, size_t capacity)
+      : capacity_(capacity), size_(0), waiters_(0), next_(0), stopping_(false) {
+    for (int i = 0; i < num_threads; i++) {
+      workers_.emplace_back(new Worker());
+    }
+    for (int i = 0; i < num_threads; i++) {
+      workers_[i]->thread = std::thread([this, i]() { Run(i); });
+    }
+  }
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  ~WorkerPool() {
+    stopping_ = true;
+    {
+      std::lock_guard<std::mutex> lock(space_mutex_);
+      space_cv_.notify_all();
+    }
+    for (auto &w : workers_) {
+      {
+        std::lock_guard<std::mutex> lock(w->mutex);
+      }
+      w->cv.notify_one();
+    }
+    for (auto &w : workers_) {
+      w->thread.join();
+    }
+  }
+
+  // Queues |msg| for |dispatcher|, which is kept alive until it has run.
+  void Submit(const std::shared_ptr<Dispatcher> &dispatcher, Message msg,
+              bool ordered, Dispatcher::Clock::time_point received) {
+    if (!AcquireSlot()) {
+      return;
+    }
+    size_t target;
+    if (ordered) {
+      target = Hash(msg.subject()) % workers_.size();
+    } else {
+      target = next_++ % workers_.size();
+      for (size_t i = 0; i < workers_.size(); i++) {
+        size_t j = (target + i) % workers_.size();
+        if (workers_[j]->idle) {
+          target = j;
+          break;
+        }
+      }
+    }
+    Worker &w = *workers_[target];
+    {
+      std::lock_guard<std::mutex> lock(w.mutex);
+      (ordered ? w.ordered : w.shared)
+          .push_back(Job{dispatcher, std::move(msg), received});
+    }
+    w.cv.notify_one();
+  }
+
+  int size() const { return static_cast<int>(workers_.size()); }
+
+  // Number of messages queued or running.
+  size_t pending() const { return size_; }
+
+ private:
+  struct Job {
+    std::shared_ptr<Dispatcher> dispatcher;
+    Message msg;
+    Dispatcher::Clock::time_point received;
+  };
+
+  struct Worker {
+    Worker() : idle(false) {}
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Job> ordered;
+    std::deque<Job> shared;
+    std::atomic<bool> idle;
+    std::thread thread;
+  };
+
+  // FNV-1a.
+  static uint64_t Hash(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s != '\0'; s++) {
+      h = (h ^ static_cast<unsigned char>(*s)) * 1099511628211ULL;
+    }
+    return h;
+  }
+
+  bool AcquireSlot() {
+    size_t n = size_.load();
+    for (;;) {
+      if (stopping_) {
+        return false;
+      }
+      if (n < capacity_) {
+        if (size_.compare_exchange_weak(n, n + 1)) {
+          return true;
+        }
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(space_mutex_);
+      waiters_++;
+      space_cv_.wait(lock,
+                     [this]() { return stopping_ || size_ < capacity_; });
+      waiters_--;
+      n = size_.load();
+    }
+  }
+
+  void ReleaseSlot() {
+    size_--;
+    // Pairs with the waiters_++ before the size check in AcquireSlot(), so
+    // either the waiter sees the new size or this sees the waiter.
+    if (waiters_ > 0) {
+      std::lock_guard<std::mutex> lock(space_mutex_);
+      space_cv_.notify_one();
+    }
+  }
+
+  static bool PopFront(std::deque<Job> *q, Job *job) {
+    if (q->empty()) {
+      return false;
+    }
+    *job = std::move(q->front());
+    q->pop_front();
+    return true;
+  }
+
+  bool Steal(size_t index, Job *job) {
+    for (size_t i = 1; i < workers_.size(); i++) {
+      Worker &victim = *workers_[(index + i) % workers_.size()];
+      std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+      if (lock.owns_lock() && !victim.shared.empty()) {
+        *job = std::move(victim.shared.back());
+        victim.shared.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Run(size_t index) {
+    Worker &w = *workers_[index];
+    Job job;
+    for (;;) {
+      bool found;
+      {
+        std::unique_lock<std::mutex> lock(w.mutex);
+        found = PopFront(&w.ordered, &job) || PopFront(&w.shared, &job);
+      }
+      if (!found && !Steal(index, &job)) {
+        std::unique_lock<std::mutex> lock(w.mutex);
+        w.idle = true;
+        w.cv.wait(lock, [&]() {
+          return stopping_ || !w.ordered.empty() || !w.shared.empty();
+        });
+        w.idle = false;
+        if (w.ordered.empty() && w.shared.empty()) {
+          return;
+        }
+        continue;
+      }
+      job.dispatcher->Dispatch(std::move(job.msg), job.received);
+      job.dispatcher.reset();
+      ReleaseSlot();
+    }
+  }
+
+  size_t capacity_;
+  std::atomic<size_t> size_;
+  std::atomic<int> waiters_;
+  std::atomic<size_t> next_;
+  std::atomic<bool> stopping_;
+  std::mutex space_mutex_;
+  std::condition_variable space_cv_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+}  // namespace nats
+
+#endif  // NATS_WORKER_POOL_H_
@@ -0,0 +1,471 @@
+#ifndef LOOPBACK_NATS_SERVER_H_
+#define LOOPBACK_NATS_SERVER_H_
+
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "uv.h"
+
+// Minimal NATS server on 127.0.0.1, enough for the cnats client: INFO,
+// CONNECT, PING/PONG, SUB (with queue groups and the * and > wildcards),
+// UNSUB (with an auto-unsubscribe count), PUB and MSG. It runs its own uv
+// loop on a background thread, so the nats labs and benchmarks need nothing
+// but the loopback interface.
+//
+// There is no authentication, TLS, headers or clustering, CONNECT options
+// are ignored (the client is always in non-verbose mode), and messages are
+// always echoed back to their publisher if it is subscribed.
+//
+// Outgoing data is appended to a per-connection buffer and written once per
+// read callback, so a burst of PUBs turns into a few large writes. A client
+// that lets more than kMaxPendingBytes pile up is dropped as a slow consumer.
+class LoopbackNatsServer {
+ public:
+  static const size_t kMaxPayload = 1024 * 1024;
+  static const size_t kMaxPendingBytes = 64 * 1024 * 1024;
+
+  LoopbackNatsServer() : port_(0), next_queue_pick_(0) {}
+
+  ~LoopbackNatsServer() { Stop(); }
+
+  // Binds to |port|, or to an ephemeral port when it is 0, and starts
+  // serving.
+  bool Start(int port) {
+    uv_loop_init(&loop_);
+    uv_tcp_init(&loop_, &listener_);
+    listener_.data = this;
+
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", port, &addr);
+    int r = uv_tcp_bind(&listener_, reinterpret_cast<sockaddr *>(&addr), 0);
+    if (r == 0) {
+      r = uv_listen(reinterpret_cast<uv_stream_t *>(&listener_), 4096,
+                    OnConnection);
+    }
+    if (r != 0) {
+      std::cout << "LoopbackNatsServer: " << uv_strerror(r) << std::endl;
+      uv_close(reinterpret_cast<uv_handle_t *>(&listener_), nullptr);
+      uv_run(&loop_, UV_RUN_DEFAULT);
+      uv_loop_close(&loop_);
+      return false;
+    }
+
+    struct sockaddr_in bound;
+    int len = sizeof(bound);
+    uv_tcp_getsockname(&listener_, reinterpret_cast<sockaddr *>(&bound), &len);
+    port_ = ntohs(bound.sin_port);
+    info_ = "INFO {\"server_id\":\"loopback\",\"version\":\"2.0.0\","
+            "\"proto\":1,\"host\":\"127.0.0.1\",\"port\":" +
+            std::to_string(port_) +
+            ",\"max_payload\":" + std::to_string(kMaxPayload) + "}\r\n";
+
+    uv_async_init(&loop_, &stop_, OnStop);
+    stop_.data = this;
+    thread_ = std::thread([this]() {
+      uv_run(&loop_, UV_RUN_DEFAULT);
+      uv_loop_close(&loop_);
+    });
+    return true;
+  }
+
+  void Stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    uv_async_send(&stop_);
+    thread_.join();
+  }
+
+  int port() const { return port_; }
+
+  std::string url() const {
+    return "nats://127.0.0.1:" + std::to_string(port_);
+  }
+
+ private:
+  struct Connection;
+
+  struct Sub {
+    Connection *conn;
+    std::string subject;
+    std::string queue;
+    std::string sid;
+    // Messages delivered so far.
+    int64_t delivered;
+    // Total deliveries after which it is removed automatically, or 0 for
+    // none. Like in gnatsd, this counts from the SUB, not from the UNSUB.
+    int64_t max;
+  };
+
+  struct Connection {
+    uv_tcp_t tcp;
+    LoopbackNatsServer *server;
+    bool closing;
+    std::string in;
+    std::string out;
+    std::map<std::string, std::unique_ptr<Sub>> subs;
+    char read_buf[64 * 1024];
+  };
+
+  struct WriteRequest {
+    uv_write_t req;
+    std::string data;
+  };
+
+  static void OnConnection(uv_stream_t *listener, int status) {
+    if (status < 0) {
+      return;
+    }
+    auto self = static_cast<LoopbackNatsServer *>(listener->data);
+    auto conn = new Connection;
+    conn->server = self;
+    conn->closing = false;
+    uv_tcp_init(&self->loop_, &conn->tcp);
+    conn->tcp.data = conn;
+    if (uv_accept(listener, reinterpret_cast<uv_stream_t *>(&conn->tcp)) != 0) {
+      self->CloseConnection(conn);
+      return;
+    }
+    uv_tcp_nodelay(&conn->tcp, 1);
+    conn->out = self->info_;
+    self->Flush(conn);
+    uv_read_start(reinterpret_cast<uv_stream_t *>(&conn->tcp), OnAlloc,
+                  OnRead);
+  }
+
+  static void OnAlloc(uv_handle_t *handle, size_t suggested_size,
+                      uv_buf_t *buf) {
+    auto conn = static_cast<Connection *>(handle->data);
+    *buf = uv_buf_init(conn->read_buf, sizeof(conn->read_buf));
+  }
+
+  static void OnRead(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+    auto conn = static_cast<Connection *>(stream->data);
+    auto self = conn->server;
+    if (nread < 0) {
+      self->CloseConnection(conn);
+      return;
+    }
+    conn->in.append(buf->base, nread);
+    size_t pos = 0;
+    while (!conn->closing && self->ParseOne(conn, &pos)) {
+    }
+    conn->in.erase(0, pos);
+
+    // Write out everything this read produced, to every receiver at once.
+    self->dirty_.insert(conn);
+    for (auto c : self->dirty_) {
+      self->Flush(c);
+    }
+    self->dirty_.clear();
+  }
+
+  // A word of a control line, pointing into Connection::in.
+  struct Token {
+    const char *data;
+    size_t size;
+
+    std::string str() const { return std::string(data, size); }
+
+    // Compares case-insensitively with |upper|, which is in upper case.
+    bool Is(const char *upper) const {
+      for (size_t i = 0; i < size; i++) {
+        if (upper[i] == '\0' ||
+            std::toupper(static_cast<unsigned char>(data[i])) != upper[i]) {
+          return false;
+        }
+      }
+      return upper[size] == '\0';
+    }
+  };
+
+  // The most words an operation this server handles has: SUB with a queue
+  // group and PUB with a reply subject.
+  static const size_t kMaxTokens = 4;
+
+  // Splits [p, end) on whitespace into |tokens|, keeping at most kMaxTokens,
+  // and returns the number of words, including any beyond that.
+  static size_t Tokenize(const char *p, const char *end, Token *tokens) {
+    size_t n = 0;
+    for (;;) {
+      while (p < end && std::isspace(static_cast<unsigned char>(*p))) {
+        p++;
+      }
+      if (p == end) {
+        return n;
+      }
+      const char *begin = p;
+      while (p < end && !std::isspace(static_cast<unsigned char>(*p))) {
+        p++;
+      }
+      if (n < kMaxTokens) {
+        tokens[n] = {begin, static_cast<size_t>(p - begin)};
+      }
+      n++;
+    }
+  }
+
+  // Handles the operation at |*pos| and moves past it. Returns false if it
+  // is not complete yet.
+  bool ParseOne(Connection *conn, size_t *pos) {
+    const std::string &in = conn->in;
+    size_t eol = in.find("\r\n", *pos);
+    if (eol == std::string::npos) {
+      if (in.size() - *pos > kMaxPayload) {
+        Fail(conn, "Maximum Control Line Exceeded");
+      }
+      return false;
+    }
+    // The line is split in place; only what is stored gets copied.
+    Token args[kMaxTokens];
+    size_t num_args = Tokenize(in.data() + *pos, in.data() + eol, args);
+    if (num_args == 0) {
+      *pos = eol + 2;
+      return true;
+    }
+    const Token &op = args[0];
+
+    if (op.Is("PUB")) {
+      if (num_args != 3 && num_args != 4) {
+        Fail(conn, "Unknown Protocol Operation");
+        return false;
+      }
+      // Followed by a space or the CR, so strtoul stops there.
+      size_t size = std::strtoul(args[num_args - 1].data, nullptr, 10);
+      if (size > kMaxPayload) {
+        Fail(conn, "Maximum Payload Violation");
+        return false;
+      }
+      if (in.size() < eol + 2 + size + 2) {
+        return false;
+      }
+      // Reused for every PUB, so they stop allocating once large enough.
+      subject_.assign(args[1].data, args[1].size);
+      if (num_args == 4) {
+        reply_.assign(args[2].data, args[2].size);
+      } else {
+        reply_.clear();
+      }
+      Publish(subject_, reply_, in.data() + eol + 2, size);
+      *pos = eol + 2 + size + 2;
+      return true;
+    }
+
+    *pos = eol + 2;
+    if (op.Is("PING")) {
+      conn->out += "PONG\r\n";
+    } else if (op.Is("PONG") || op.Is("CONNECT")) {
+    } else if (op.Is("SUB") && (num_args == 3 || num_args == 4)) {
+      std::unique_ptr<Sub> sub(
+          new Sub{conn, args[1].str(),
+                  num_args == 4 ? args[2].str() : std::string(),
+                  args[num_args - 1].str(), 0, 0});
+      auto &slot = conn->subs[sub->sid];
+      if (slot) {
+        RemoveSub(slot.get());
+      }
+      AddSub(sub.get());
+      slot = std::move(sub);
+    } else if (op.Is("UNSUB") && (num_args == 2 || num_args == 3)) {
+      auto it = conn->subs.find(args[1].str());
+      if (it != conn->subs.end()) {
+        int64_t max = num_args == 3 ? std::atoll(args[2].data) : 0;
+        if (max > 0 && it->second->delivered < max) {
+          it->second->max = max;
+        } else {
+          RemoveSub(it->second.get());
+          conn->subs.erase(it);
+        }
+      }
+    } else {
+      Fail(conn, "Unknown Protocol Operation");
+      return false;
+    }
+    return true;
+  }
+
+  static bool IsLiteral(const std::string &subject) {
+    return subject.find_first_of("*>") == std::string::npos;
+  }
+
+  // Matches token by token; * matches one token and a trailing > the rest.
+  static bool Matches(const std::string &pattern, const std::string &subject) {
+    size_t p = 0, s = 0;
+    for (;;) {
+      size_t pe = pattern.find('.', p), se = subject.find('.', s);
+      std::string pt = pattern.substr(p, pe - p);
+      if (pt == ">") {
+        return s < subject.size();
+      }
+      if (pt != "*" && pt != subject.substr(s, se - s)) {
+        return false;
+      }
+      if (pe == std::string::npos || se == std::string::npos) {
+        return pe == se;
+      }
+      p = pe + 1;
+      s = se + 1;
+    }
+  }
+
+  void AddSub(Sub *sub) {
+    if (IsLiteral(sub->subject)) {
+      literal_subs_[sub->subject].insert(sub);
+    } else {
+      wildcard_subs_.insert(sub);
+    }
+  }
+
+  void RemoveSub(Sub *sub) {
+    if (IsLiteral(sub->subject)) {
+      auto it = literal_subs_.find(sub->subject);
+      it->second.erase(sub);
+      if (it->second.empty()) {
+        literal_subs_.erase(it);
+      }
+    } else {
+      wildcard_subs_.erase(sub);
+    }
+  }
+
+  void Publish(const std::string &subject, const std::string &reply,
+               const char *data, size_t size) {
+    std::vector<Sub *> matches;
+    auto it = literal_subs_.find(subject);
+    if (it != literal_subs_.end()) {
+      matches.assign(it->second.begin(), it->second.end());
+    }
+    for (auto sub : wildcard_subs_) {
+      if (Matches(sub->subject, subject)) {
+        matches.push_back(sub);
+      }
+    }
+
+    // Every plain subscription gets the message; each queue group gets it
+    // once, on a member picked round robin.
+    std::map<std::string, std::vector<Sub *>> groups;
+    for (auto sub : matches) {
+      if (sub->queue.empty()) {
+        Deliver(sub, subject, reply, data, size);
+      } else {
+        groups[sub->queue].push_back(sub);
+      }
+    }
+    for (auto &g : groups) {
+      Deliver(g.second[next_queue_pick_++ % g.second.size()], subject, reply,
+              data, size);
+    }
+  }
+
+  void Deliver(Sub *sub, const std::string &subject, const std::string &reply,
+               const char *data, size_t size) {
+    Connection *conn = sub->conn;
+    if (conn->closing) {
+      return;
+    }
+    std::string &out = conn->out;
+    out += "MSG ";
+    out += subject;
+    out += ' ';
+    out += sub->sid;
+    out += ' ';
+    if (!reply.empty()) {
+      out += reply;
+      out += ' ';
+    }
+    out += std::to_string(size);
+    out += "\r\n";
+    out.append(data, size);
+    out += "\r\n";
+    dirty_.insert(conn);
+
+    sub->delivered++;
+    if (sub->max > 0 && sub->delivered >= sub->max) {
+      std::string sid = sub->sid;
+      RemoveSub(sub);
+      conn->subs.erase(sid);
+    }
+  }
+
+  void Flush(Connection *conn) {
+    if (conn->closing || conn->out.empty()) {
+      return;
+    }
+    auto stream = reinterpret_cast<uv_stream_t *>(&conn->tcp);
+    if (uv_stream_get_write_queue_size(stream) > kMaxPendingBytes) {
+      conn->out.clear();
+      CloseConnection(conn);
+      return;
+    }
+    auto w = new WriteRequest;
+    w->data.swap(conn->out);
+    uv_buf_t buf = uv_buf_init(&w->data[0], w->data.size());
+    uv_write(&w->req, stream, &buf, 1, [](uv_write_t *req, int status) {
+      delete reinterpret_cast<WriteRequest *>(req);
+    });
+  }
+
+  void Fail(Connection *conn, const std::string &error) {
+    conn->out += "-ERR '" + error + "'\r\n";
+    Flush(conn);
+    CloseConnection(conn);
+  }
+
+  void CloseConnection(Connection *conn) {
+    if (conn->closing) {
+      return;
+    }
+    conn->closing = true;
+    for (auto &s : conn->subs) {
+      RemoveSub(s.second.get());
+    }
+    conn->subs.clear();
+    uv_close(reinterpret_cast<uv_handle_t *>(&conn->tcp), [](uv_handle_t *h) {
+      delete static_cast<Connection *>(h->data);
+    });
+  }
+
+  static void OnStop(uv_async_t *async) {
+    auto self = static_cast<LoopbackNatsServer *>(async->data);
+    uv_walk(&self->loop_,
+            [](uv_handle_t *h, void *arg) {
+              auto self = static_cast<LoopbackNatsServer *>(arg);
+              if (uv_is_closing(h)) {
+                return;
+              }
+              if (h == reinterpret_cast<uv_handle_t *>(&self->listener_) ||
+                  h == reinterpret_cast<uv_handle_t *>(&self->stop_)) {
+                uv_close(h, nullptr);
+              } else {
+                self->CloseConnection(static_cast<Connection *>(h->data));
+              }
+            },
+            self);
+  }
+
+  int port_;
+  std::string info_;
+  uv_loop_t loop_;
+  uv_tcp_t listener_;
+  uv_async_t stop_;
+  std::thread thread_;
+  // Subscriptions without wildcards are looked up by subject; the others
+  // are matched one by one.
+  std::unordered_map<std::string, std::set<Sub *>> literal_subs_;
+  std::set<Sub *> wildcard_subs_;
+  std::set<Connection *> dirty_;
+  size_t next_queue_pick_;
+  // Subject and reply subject of the PUB being handled.
+  std::string subject_;
+  std::string reply_;
+};
+
+#endif  // LOOPBACK_NATS_SERVER_H_
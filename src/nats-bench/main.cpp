@@ -0,0 +1,197 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "nats/nats.h"
+
+#include "latency_histogram.h"
+#include "loopback_nats_server.h"
+#include "nats_connection.h"
+
+DEFINE_int32(msgs, 100000, "Messages published in the pub/sub run.");
+DEFINE_int32(payload_size, 128, "Message size in bytes.");
+DEFINE_int32(subscribers, 1, "Subscribing connections, i.e. the fan-out.");
+DEFINE_int32(round_trips, 10000, "Ping-pongs in the latency run.");
+DEFINE_int32(port, 0, "Loopback server port. 0 picks a free one.");
+DEFINE_string(url, "", "Benchmark this server instead of the loopback one.");
+DEFINE_bool(serve, false,
+            "Only run the loopback server, on --port or 4222, so that the "
+            "other nats labs can connect to it.");
+
+using Clock = std::chrono::steady_clock;
+
+const int64_t kFlushTimeoutMs = 10000;
+// A run is given up when no message arrives for this long.
+const int64_t kIdleTimeoutMs = 5000;
+
+std::unique_ptr<nats::Connection> Connect(const std::string &url,
+                                          nats::FlushPolicy flush_policy) {
+  auto config = nats::Connection::DefaultConfig();
+  config.url = url;
+  config.flush_policy = flush_policy;
+  std::unique_ptr<nats::Connection> conn(new nats::Connection(config));
+  if (!*conn) {
+    std::cout << "connect error: " << conn->error() << std::endl;
+    return nullptr;
+  }
+  return conn;
+}
+
+// Publishes FLAGS_msgs messages on one connection to FLAGS_subscribers
+// connections and reports publish and delivery rates.
+bool RunPubSub(const std::string &url) {
+  const char *kSubject = "bench.pubsub";
+  std::atomic<int64_t> received(0);
+  auto options = nats::DefaultSubscribeOptions();
+  // The run measures throughput, so nothing may be dropped on the way.
+  options.pending_msgs_limit = -1;
+  options.pending_bytes_limit = -1;
+
+  std::vector<std::unique_ptr<nats::Connection>> subscribers;
+  for (int i = 0; i < FLAGS_subscribers; i++) {
+    auto conn = Connect(url, nats::FlushPolicy::kBuffered);
+    if (!conn) {
+      return false;
+    }
+    auto sub = conn->Subscribe(
+        kSubject, [&received](nats::Message) { received++; }, options);
+    // Makes sure the server has the SUB before anything is published.
+    if (sub == nullptr || !conn->Flush(kFlushTimeoutMs)) {
+      std::cout << "subscribe error: " << conn->error() << std::endl;
+      return false;
+    }
+    subscribers.push_back(std::move(conn));
+  }
+  auto publisher = Connect(url, nats::FlushPolicy::kBuffered);
+  if (!publisher) {
+    return false;
+  }
+
+  std::string payload(FLAGS_payload_size, 'x');
+  int64_t expected = static_cast<int64_t>(FLAGS_msgs) * FLAGS_subscribers;
+  auto start = Clock::now();
+  for (int i = 0; i < FLAGS_msgs; i++) {
+    if (!publisher->Publish(kSubject, payload)) {
+      std::cout << "publish error: " << publisher->error() << std::endl;
+      return false;
+    }
+  }
+  if (!publisher->Flush(kFlushTimeoutMs)) {
+    std::cout << "flush error: " << publisher->error() << std::endl;
+    return false;
+  }
+  double publish_seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  int64_t last = -1;
+  auto last_progress = Clock::now();
+  while (received < expected) {
+    int64_t n = received;
+    if (n != last) {
+      last = n;
+      last_progress = Clock::now();
+    } else if (Clock::now() - last_progress >
+               std::chrono::milliseconds(kIdleTimeoutMs)) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  double mib = 1024.0 * 1024.0;
+  std::cout << "pub/sub: " << FLAGS_msgs << " msgs x " << FLAGS_subscribers
+            << " subscribers, " << FLAGS_payload_size << " bytes" << std::endl
+            << "  publish: " << FLAGS_msgs / publish_seconds << " msgs/s, "
+            << FLAGS_msgs * FLAGS_payload_size / publish_seconds / mib
+            << " MiB/s" << std::endl
+            << "  deliver: " << received << "/" << expected << " in "
+            << seconds << "s, " << received / seconds << " msgs/s, "
+            << received * FLAGS_payload_size / seconds / mib << " MiB/s"
+            << std::endl;
+  return received == expected;
+}
+
+// Sends FLAGS_round_trips pings one at a time to a connection that echoes
+// them back, and reports the round-trip latency.
+bool RunRoundTrip(const std::string &url) {
+  auto pinger = Connect(url, nats::FlushPolicy::kImmediate);
+  auto ponger = Connect(url, nats::FlushPolicy::kImmediate);
+  if (!pinger || !ponger) {
+    return false;
+  }
+  nats::Connection &pong_conn = *ponger;
+  auto echo = ponger->Subscribe("bench.ping", [&pong_conn](nats::Message msg) {
+    pong_conn.Publish("bench.pong", msg.data());
+  });
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  int pongs = 0;
+  auto pong = pinger->Subscribe("bench.pong", [&](nats::Message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pongs++;
+    cv.notify_one();
+  });
+  if (echo == nullptr || pong == nullptr || !ponger->Flush(kFlushTimeoutMs) ||
+      !pinger->Flush(kFlushTimeoutMs)) {
+    std::cout << "subscribe error" << std::endl;
+    return false;
+  }
+
+  std::string payload(FLAGS_payload_size, 'x');
+  LatencyHistogram latency;
+  for (int i = 0; i < FLAGS_round_trips; i++) {
+    auto t0 = Clock::now();
+    pinger->Publish("bench.ping", payload);
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!cv.wait_for(lock, std::chrono::milliseconds(kIdleTimeoutMs),
+                     [&]() { return pongs > i; })) {
+      std::cout << "round trip timed out" << std::endl;
+      return false;
+    }
+    latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+                       Clock::now() - t0)
+                       .count());
+  }
+
+  std::cout << "round trip: " << latency.count() << " pings" << std::endl
+            << "  latency (us): mean " << latency.mean() << ", p50 "
+            << latency.Percentile(0.5) << ", p99 " << latency.Percentile(0.99)
+            << ", p999 " << latency.Percentile(0.999) << ", max "
+            << latency.max() << std::endl;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  gflags::SetUsageMessage("Pub/sub benchmark for nats::Connection.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  LoopbackNatsServer server;
+  if (FLAGS_serve) {
+    if (!server.Start(FLAGS_port != 0 ? FLAGS_port : 4222)) {
+      return 1;
+    }
+    std::cout << "serving on " << server.url() << std::endl;
+    for (;;) {
+      std::this_thread::sleep_for(std::chrono::hours(1));
+    }
+  }
+
+  std::string url = FLAGS_url;
+  if (url.empty()) {
+    if (!server.Start(FLAGS_port)) {
+      return 1;
+    }
+    url = server.url();
+  }
+  std::cout << "url: " << url << std::endl;
+
+  return RunPubSub(url) && RunRoundTrip(url) ? 0 : 1;
+}
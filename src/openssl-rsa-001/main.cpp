@@ -1,12 +1,23 @@
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include "openssl/err.h"
 #include "openssl/pem.h"
 
+#include "rsa_batch_cryptor.h"
+#include "rsa_batch_verifier.h"
 #include "rsa_cryptor.h"
+#include "rsa_envelope.h"
+#include "rsa_key_store.h"
+#include "rsa_signer.h"
+
+const size_t kFileChunkSize = 1024 * 1024;
 
 void PrintOpenSSLError() {
   std::shared_ptr<BIO> bio(BIO_new_file("/dev/stdout", "w"), BIO_free);
@@ -16,88 +27,153 @@ void PrintOpenSSLError() {
   ERR_print_errors(bio.get());
 }
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cout << "Usage: " << argv[0] << " <key-path-prefix>" << std::endl;
-    return 1;
+bool SealFile(const rsa::Key &public_key, FILE *in, FILE *out) {
+  rsa::EnvelopeSealer sealer(public_key);
+  std::string header;
+  if (!sealer.Init(&header)) {
+    std::cout << "Failed to seal: " << sealer.last_error() << std::endl;
+    return false;
   }
+  fwrite(header.data(), 1, header.size(), out);
 
-  std::string key_path_prefix = argv[1];
-
-  std::string public_key;
-  {
-    std::string path = key_path_prefix + "public.pem";
-    std::ifstream ifs(path);
-    if (!ifs) {
-      std::cout << "Failed to load " << path << std::endl;
-      return 1;
+  std::vector<unsigned char> src(kFileChunkSize), dst(kFileChunkSize);
+  size_t n;
+  while ((n = fread(src.data(), 1, src.size(), in)) > 0) {
+    int size = sealer.Update(src.data(), n, dst.data());
+    if (size < 0) {
+      std::cout << "Failed to seal: " << sealer.last_error() << std::endl;
+      return false;
     }
-    public_key.assign(std::istreambuf_iterator<char>(ifs),
-                      std::istreambuf_iterator<char>());
+    fwrite(dst.data(), 1, size, out);
   }
-  std::string private_key;
-  {
-    std::string path = key_path_prefix + "private.pem";
-    std::ifstream ifs(path);
-    if (!ifs) {
-      std::cout << "Failed to load " << path << std::endl;
-      return 1;
-    }
-    private_key.assign(std::istreambuf_iterator<char>(ifs),
-                       std::istreambuf_iterator<char>());
+
+  unsigned char tag[rsa::envelope::kTagSize];
+  if (!sealer.Final(tag)) {
+    std::cout << "Failed to seal: " << sealer.last_error() << std::endl;
+    return false;
   }
-  std::string private_key_passphrase;
-  {
-    std::string path = key_path_prefix + "passphrase";
-    std::ifstream ifs(path);
-    if (!ifs) {
-      std::cout << "Failed to load " << path << std::endl;
-      return 1;
+  fwrite(tag, 1, sizeof(tag), out);
+  return !ferror(in) && !ferror(out);
+}
+
+bool OpenFile(const rsa::Key &private_key, FILE *in, FILE *out) {
+  rsa::EnvelopeOpener opener(private_key);
+  std::vector<unsigned char> src(kFileChunkSize + rsa::envelope::kTagSize),
+      dst(kFileChunkSize);
+
+  // The header is read in two steps since its size is in its first bytes.
+  const size_t kPrefixSize = rsa::envelope::kPrefixSize;
+  size_t pending = fread(src.data(), 1, kPrefixSize, in);
+  if (pending == kPrefixSize) {
+    size_t header_size = rsa::envelope::HeaderSize(src.data());
+    pending += fread(src.data() + kPrefixSize, 1, header_size - kPrefixSize, in);
+  }
+  if (opener.Init(src.data(), pending) <= 0) {
+    std::cout << "Failed to open: invalid header. " << opener.last_error()
+              << std::endl;
+    return false;
+  }
+
+  // The last kTagSize bytes are the tag, so that many are always held back.
+  pending = 0;
+  size_t n;
+  while ((n = fread(src.data() + pending, 1, kFileChunkSize, in)) > 0) {
+    pending += n;
+    if (pending <= rsa::envelope::kTagSize) {
+      continue;
     }
-    std::getline(ifs, private_key_passphrase);
+    size_t body = pending - rsa::envelope::kTagSize;
+    int size = opener.Update(src.data(), body, dst.data());
+    if (size < 0) {
+      std::cout << "Failed to open: " << opener.last_error() << std::endl;
+      return false;
+    }
+    fwrite(dst.data(), 1, size, out);
+    std::copy(src.begin() + body, src.begin() + pending, src.begin());
+    pending = rsa::envelope::kTagSize;
   }
 
-  OpenSSL_add_all_algorithms();
+  if (pending != rsa::envelope::kTagSize || !opener.Final(src.data())) {
+    std::cout << "Failed to open: " << opener.last_error() << std::endl;
+    return false;
+  }
+  return !ferror(in) && !ferror(out);
+}
 
-  rsa::RSAPtr public_rsa;
-  {
-    std::shared_ptr<BIO> bio(BIO_new_mem_buf(public_key.c_str(), -1), BIO_free);
-    public_rsa = rsa::Wrap(
-        PEM_read_bio_RSA_PUBKEY(bio.get(), nullptr, nullptr, nullptr));
-    if (!public_rsa) {
-      std::cout << "Failed to parse public key." << std::endl;
-      return 1;
-    }
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 5) {
+    std::cout << "Usage: " << argv[0] << " <key-path-prefix>" << std::endl
+              << "       " << argv[0]
+              << " <key-path-prefix> (seal|open) <input> <output>"
+              << std::endl;
+    return 1;
   }
-  rsa::RSAPtr private_rsa;
-  {
-    std::shared_ptr<BIO> bio(BIO_new_mem_buf(private_key.c_str(), -1),
-                             BIO_free);
-    private_rsa = rsa::Wrap(PEM_read_bio_RSAPrivateKey(
-        bio.get(), nullptr, nullptr,
-        const_cast<char *>(private_key_passphrase.c_str())));
-    if (!private_rsa) {
-      std::cout << "Failed to parse private key." << std::endl;
-      return 1;
-    }
+
+  std::string key_path_prefix = argv[1];
+
+  OpenSSL_add_all_algorithms();
+
+  rsa::KeyStore key_store(1);
+  std::string fingerprint;
+  if (!key_store.Load(key_path_prefix, &fingerprint)) {
+    std::cout << key_store.last_error() << std::endl;
+    PrintOpenSSLError();
+    return 1;
   }
+  rsa::Key public_key = key_store.GetKey(fingerprint, rsa::Key::Type::kPublic);
+  rsa::Key private_key =
+      key_store.GetKey(fingerprint, rsa::Key::Type::kPrivate);
 
-  rsa::Cryptor public_key_cryptor(
-      rsa::Key(public_rsa, rsa::Key::Type::kPublic));
+  rsa::Cryptor public_key_cryptor(public_key);
   if (!public_key_cryptor.IsValid()) {
     std::cout << "public_key_cryptor is invalid: "
               << public_key_cryptor.last_error() << std::endl;
     return 1;
   }
 
-  rsa::Cryptor private_key_cryptor(
-      rsa::Key(private_rsa, rsa::Key::Type::kPrivate));
+  rsa::Cryptor private_key_cryptor(private_key);
   if (!private_key_cryptor.IsValid()) {
     std::cout << "private_key_cryptor is invalid: "
               << private_key_cryptor.last_error() << std::endl;
     return 1;
   }
 
+  if (argc == 5) {
+    std::string mode = argv[2];
+    if (mode != "seal" && mode != "open") {
+      std::cout << "Unknown mode: " << mode << std::endl;
+      return 1;
+    }
+    // The input is checked first so that a bad input path does not truncate
+    // the output.
+    std::unique_ptr<FILE, decltype(&fclose)> in(fopen(argv[3], "rb"), fclose);
+    if (!in) {
+      std::cout << "Failed to open " << argv[3] << ": " << std::strerror(errno)
+                << std::endl;
+      return 1;
+    }
+    std::unique_ptr<FILE, decltype(&fclose)> out(fopen(argv[4], "wb"), fclose);
+    if (!out) {
+      std::cout << "Failed to open " << argv[4] << ": " << std::strerror(errno)
+                << std::endl;
+      return 1;
+    }
+    bool ok;
+    if (mode == "seal") {
+      ok = SealFile(public_key, in.get(), out.get());
+    } else {
+      ok = OpenFile(private_key, in.get(), out.get());
+    }
+    if (!ok) {
+      // Do not leave unauthenticated plaintext behind.
+      out.reset();
+      std::remove(argv[4]);
+      PrintOpenSSLError();
+      return 1;
+    }
+    return 0;
+  }
+
   std::string input;
   std::cin >> input;
 
@@ -153,5 +229,84 @@ int main(int argc, char **argv) {
     std::cout << "prv enc -> pub dec => " << decrypted << std::endl;
   }
 
+  {
+    const int kBatchSize = 64;
+    std::vector<std::string> encrypted(
+        kBatchSize,
+        std::string(public_key_cryptor.GetOutputBufferSizeForEncryption(), 0));
+    for (auto &e : encrypted) {
+      int encrypted_size = public_key_cryptor.Encrypt(input, e);
+      if (encrypted_size < 0) {
+        std::cout << "Failed to encrypt by public key: "
+                  << public_key_cryptor.last_error() << std::endl;
+        return 1;
+      }
+      e.resize(encrypted_size);
+    }
+
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    rsa::BatchCryptor batch_cryptor(private_key, num_threads);
+    if (!batch_cryptor.IsValid()) {
+      std::cout << "batch_cryptor is invalid: " << batch_cryptor.last_error()
+                << std::endl;
+      return 1;
+    }
+    std::vector<std::string> decrypted(
+        kBatchSize,
+        std::string(batch_cryptor.GetOutputBufferSizeForDecryption(), 0));
+    std::vector<int> sizes;
+    if (batch_cryptor.Decrypt(encrypted, decrypted, sizes) != 0) {
+      std::cout << "Failed to decrypt batch by private key: "
+                << batch_cryptor.last_error() << std::endl;
+      PrintOpenSSLError();
+      return 1;
+    }
+    int matched = 0;
+    for (int i = 0; i < kBatchSize; i++) {
+      decrypted[i].resize(sizes[i]);
+      matched += decrypted[i] == input;
+    }
+    std::cout << "pub enc -> prv dec (batch of " << kBatchSize << " on "
+              << num_threads << " threads) => " << matched << " matched"
+              << std::endl;
+  }
+
+  {
+    rsa::Signer signer(private_key);
+    if (!signer.IsValid()) {
+      std::cout << "signer is invalid: " << signer.last_error() << std::endl;
+      return 1;
+    }
+    std::string sig(signer.GetSignatureSize(), 0);
+    int sig_size = signer.Sign(input, sig);
+    if (sig_size < 0) {
+      std::cout << "Failed to sign: " << signer.last_error() << std::endl;
+      PrintOpenSSLError();
+      return 1;
+    }
+    sig.resize(sig_size);
+
+    const int kBatchSize = 1000;
+    std::vector<std::string> messages(kBatchSize, input);
+    std::vector<std::string> sigs(kBatchSize, sig);
+    // Every other signature is broken to see that it is rejected.
+    for (int i = 1; i < kBatchSize; i += 2) {
+      sigs[i][0] ^= 1;
+    }
+
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    rsa::BatchVerifier batch_verifier(public_key, num_threads);
+    if (!batch_verifier.IsValid()) {
+      std::cout << "batch_verifier is invalid: " << batch_verifier.last_error()
+                << std::endl;
+      return 1;
+    }
+    std::vector<char> results;
+    int failures = batch_verifier.Verify(messages, sigs, results);
+    std::cout << "prv sign -> pub verify (batch of " << kBatchSize << " on "
+              << num_threads << " threads) => " << kBatchSize - failures
+              << " valid, " << failures << " invalid" << std::endl;
+  }
+
   return 0;
 }
@@ -0,0 +1,148 @@
+#ifndef RSA_BATCH_CRYPTOR_H_
+#define RSA_BATCH_CRYPTOR_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rsa_cryptor.h"
+#include "thread_pool.h"
+
+namespace rsa {
+
+struct ConstBuffer {
+  const unsigned char *data;
+  int size;
+};
+
+struct MutableBuffer {
+  unsigned char *data;
+  int size;
+};
+
+// Runs many Encrypt/Decrypt calls of the same key in parallel. Every pool
+// thread has its own Cryptor over its own copy of the key, so the threads
+// share nothing while they work.
+class BatchCryptor {
+ public:
+  BatchCryptor(Key key, int num_threads)
+      : BatchCryptor(std::move(key), DefaultCryptoOption(), num_threads) {}
+
+  BatchCryptor(Key key, CryptoOption option, int num_threads)
+      : pool_(num_threads) {
+    for (int i = 0; i < pool_.size(); i++) {
+      cryptors_.emplace_back(new Cryptor(key.Duplicate(), option));
+    }
+    // The copies share no state with |key|, so each one is warmed up here
+    // rather than in the first batch.
+    pool_.ParallelFor(cryptors_.size(),
+                      [this](int /* worker */, size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; i++) {
+                          cryptors_[i]->WarmUp();
+                        }
+                      });
+  }
+
+  bool IsValid() {
+    for (auto &cryptor : cryptors_) {
+      if (!cryptor->IsValid()) {
+        last_error_ = cryptor->last_error();
+        return false;
+      }
+    }
+    return !cryptors_.empty();
+  }
+
+  // Encrypts src[i] into dst[i] for every i < n, and stores the output size,
+  // or -1 on failure, into sizes[i]. Returns the number of failures;
+  // last_error() describes one of them.
+  int Encrypt(const ConstBuffer *src, MutableBuffer *dst, int *sizes,
+              size_t n) {
+    return Run(src, dst, sizes, n, &Cryptor::Encrypt);
+  }
+
+  // Same as Encrypt() in the other direction.
+  int Decrypt(const ConstBuffer *src, MutableBuffer *dst, int *sizes,
+              size_t n) {
+    return Run(src, dst, sizes, n, &Cryptor::Decrypt);
+  }
+
+  template <class SrcBuffer, class DstBuffer>
+  int Encrypt(const std::vector<SrcBuffer> &src, std::vector<DstBuffer> &dst,
+              std::vector<int> &sizes) {
+    return RunContainers(src, dst, sizes, &Cryptor::Encrypt);
+  }
+
+  template <class SrcBuffer, class DstBuffer>
+  int Decrypt(const std::vector<SrcBuffer> &src, std::vector<DstBuffer> &dst,
+              std::vector<int> &sizes) {
+    return RunContainers(src, dst, sizes, &Cryptor::Decrypt);
+  }
+
+  int GetOutputBufferSizeForEncryption() {
+    return cryptors_.front()->GetOutputBufferSizeForEncryption();
+  }
+
+  int GetOutputBufferSizeForDecryption() {
+    return cryptors_.front()->GetOutputBufferSizeForDecryption();
+  }
+
+  const std::string &last_error() const { return last_error_; }
+
+ private:
+  using CryptFunc = int (Cryptor::*)(const unsigned char *, int,
+                                     unsigned char *, int);
+
+  int Run(const ConstBuffer *src, MutableBuffer *dst, int *sizes, size_t n,
+          CryptFunc crypt) {
+    std::mutex mutex;
+    int failures = 0;
+    pool_.ParallelFor(n, [&](int worker, size_t begin, size_t end) {
+      Cryptor &cryptor = *cryptors_[worker];
+      int local_failures = 0;
+      for (size_t i = begin; i < end; i++) {
+        sizes[i] = (cryptor.*crypt)(src[i].data, src[i].size, dst[i].data,
+                                    dst[i].size);
+        if (sizes[i] < 0) {
+          local_failures++;
+        }
+      }
+      if (local_failures > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failures += local_failures;
+        last_error_ = cryptor.last_error();
+      }
+    });
+    return failures;
+  }
+
+  template <class SrcBuffer, class DstBuffer>
+  int RunContainers(const std::vector<SrcBuffer> &src,
+                    std::vector<DstBuffer> &dst, std::vector<int> &sizes,
+                    CryptFunc crypt) {
+    if (dst.size() < src.size()) {
+      last_error_ = "Too few output buffers.";
+      return -1;
+    }
+    std::vector<ConstBuffer> src_bufs(src.size());
+    std::vector<MutableBuffer> dst_bufs(src.size());
+    for (size_t i = 0; i < src.size(); i++) {
+      src_bufs[i] = {reinterpret_cast<const unsigned char *>(&src[i][0]),
+                     static_cast<int>(container_sizeof(src[i]))};
+      dst_bufs[i] = {reinterpret_cast<unsigned char *>(&dst[i][0]),
+                     static_cast<int>(container_sizeof(dst[i]))};
+    }
+    sizes.resize(src.size());
+    return Run(src_bufs.data(), dst_bufs.data(), sizes.data(), src.size(),
+               crypt);
+  }
+
+  ThreadPool pool_;
+  std::vector<std::unique_ptr<Cryptor>> cryptors_;
+  std::string last_error_;
+};
+
+}  // namespace rsa
+
+#endif  // RSA_BATCH_CRYPTOR_H_
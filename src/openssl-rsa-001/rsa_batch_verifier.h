@@ -0,0 +1,101 @@
+#ifndef RSA_BATCH_VERIFIER_H_
+#define RSA_BATCH_VERIFIER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rsa_batch_cryptor.h"
+#include "rsa_signer.h"
+#include "thread_pool.h"
+
+namespace rsa {
+
+// Verifies many signatures of the same key in parallel, with one Verifier
+// per pool thread over its own copy of the key.
+class BatchVerifier {
+ public:
+  BatchVerifier(Key public_key, int num_threads)
+      : BatchVerifier(std::move(public_key), DefaultSignOption(),
+                      num_threads) {}
+
+  BatchVerifier(Key public_key, SignOption option, int num_threads)
+      : pool_(num_threads) {
+    for (int i = 0; i < pool_.size(); i++) {
+      verifiers_.emplace_back(new Verifier(public_key.Duplicate(), option));
+    }
+    // See BatchCryptor.
+    pool_.ParallelFor(verifiers_.size(),
+                      [this](int /* worker */, size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; i++) {
+                          verifiers_[i]->WarmUp();
+                        }
+                      });
+  }
+
+  bool IsValid() {
+    for (auto &verifier : verifiers_) {
+      if (!verifier->IsValid()) {
+        last_error_ = verifier->last_error();
+        return false;
+      }
+    }
+    return !verifiers_.empty();
+  }
+
+  // Checks that sigs[i] is a signature of messages[i] for every i < n, and
+  // stores the result into results[i]. Returns the number of invalid ones.
+  int Verify(const ConstBuffer *messages, const ConstBuffer *sigs,
+             bool *results, size_t n) {
+    std::atomic<int> failures(0);
+    pool_.ParallelFor(n, [&](int worker, size_t begin, size_t end) {
+      Verifier &verifier = *verifiers_[worker];
+      int local_failures = 0;
+      for (size_t i = begin; i < end; i++) {
+        results[i] = verifier.Verify(messages[i].data, messages[i].size,
+                                     sigs[i].data, sigs[i].size);
+        if (!results[i]) {
+          local_failures++;
+        }
+      }
+      failures += local_failures;
+    });
+    return failures;
+  }
+
+  template <class Buffer, class SigBuffer>
+  int Verify(const std::vector<Buffer> &messages,
+             const std::vector<SigBuffer> &sigs, std::vector<char> &results) {
+    if (sigs.size() < messages.size()) {
+      last_error_ = "Too few signatures.";
+      return -1;
+    }
+    std::vector<ConstBuffer> message_bufs(messages.size());
+    std::vector<ConstBuffer> sig_bufs(messages.size());
+    for (size_t i = 0; i < messages.size(); i++) {
+      message_bufs[i] = {
+          reinterpret_cast<const unsigned char *>(&messages[i][0]),
+          static_cast<int>(container_sizeof(messages[i]))};
+      sig_bufs[i] = {reinterpret_cast<const unsigned char *>(&sigs[i][0]),
+                     static_cast<int>(container_sizeof(sigs[i]))};
+    }
+    // std::vector<bool> has no data(), so the results go through a buffer.
+    std::unique_ptr<bool[]> buf(new bool[messages.size()]);
+    int failures = Verify(message_bufs.data(), sig_bufs.data(), buf.get(),
+                          messages.size());
+    results.assign(buf.get(), buf.get() + messages.size());
+    return failures;
+  }
+
+  const std::string &last_error() const { return last_error_; }
+
+ private:
+  ThreadPool pool_;
+  std::vector<std::unique_ptr<Verifier>> verifiers_;
+  std::string last_error_;
+};
+
+}  // namespace rsa
+
+#endif  // RSA_BATCH_VERIFIER_H_
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "openssl/evp.h"
 #include "openssl/rsa.h"
@@ -58,33 +59,139 @@ int GetPaddingSize(const CryptoOption &opt) {
   return -1;
 }
 
+using EVPPKeySharedPtr = std::shared_ptr<EVP_PKEY>;
+
 class Key {
  public:
   enum class Type { kPublic, kPrivate };
 
   Key(RSAPtr rsa, Type type) : rsa_(rsa), type_(type) {}
 
+  // |pkey| must wrap |rsa|. Everything built from this key then uses |pkey|
+  // instead of a new EVP_PKEY; see KeyStore.
+  Key(RSAPtr rsa, Type type, EVPPKeySharedPtr pkey)
+      : rsa_(rsa), type_(type), pkey_(pkey) {}
+
   int size() const { return RSA_size(rsa_.get()); }
   Type type() const { return type_; }
+  EVP_PKEY *pkey() const { return pkey_.get(); }
 
   explicit operator bool() const { return !!rsa_; }
   operator RSA *() const { return rsa_.get(); }
 
+  // Returns a key with its own copy of the RSA structure, so that threads
+  // using the copies do not contend on the shared blinding state. The copy
+  // has no EVP_PKEY of its own yet.
+  Key Duplicate() const {
+    if (!rsa_) {
+      return *this;
+    }
+    RSA *copy = type_ == Type::kPrivate ? RSAPrivateKey_dup(rsa_.get())
+                                        : RSAPublicKey_dup(rsa_.get());
+    return Key(Wrap(copy), type_);
+  }
+
  private:
   RSAPtr rsa_;
   Type type_;
+  EVPPKeySharedPtr pkey_;
 };
 
+using EVPPKeyPtr = std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>;
+using EVPPKeyCtxPtr =
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)>;
+
+// Returns an EVP_PKEY referring to the RSA structure of |key|, or null. If
+// |key| already has one, that one is shared.
+inline EVPPKeyPtr NewEVPPKey(const Key &key) {
+  EVPPKeyPtr pkey(nullptr, EVP_PKEY_free);
+  if (!key) {
+    return pkey;
+  }
+  if (key.pkey() != nullptr) {
+    if (EVP_PKEY_up_ref(key.pkey()) == 1) {
+      pkey.reset(key.pkey());
+    }
+    return pkey;
+  }
+  pkey.reset(EVP_PKEY_new());
+  if (pkey && EVP_PKEY_set1_RSA(pkey.get(), key) != 1) {
+    pkey.reset();
+  }
+  return pkey;
+}
+
+// Runs one raw RSA operation with |pkey|, a private one for a private key,
+// so that OpenSSL sets up the Montgomery contexts and the blinding now rather
+// than on first use. OpenSSL 3 keeps them in the provider key it exports
+// |pkey| to, which every later EVP_PKEY_CTX of |pkey| shares.
+inline bool WarmUp(EVP_PKEY *pkey, Key::Type type) {
+  EVPPKeyCtxPtr ctx(EVP_PKEY_CTX_new(pkey, nullptr), EVP_PKEY_CTX_free);
+  if (!ctx) {
+    return false;
+  }
+  size_t size = EVP_PKEY_size(pkey);
+  std::vector<unsigned char> in(size, 0), out(size);
+  in[size - 1] = 2;
+  size_t out_size = size;
+  if (type == Key::Type::kPrivate) {
+    return EVP_PKEY_sign_init(ctx.get()) > 0 &&
+           EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_NO_PADDING) > 0 &&
+           EVP_PKEY_sign(ctx.get(), out.data(), &out_size, in.data(), size) >
+               0;
+  }
+  return EVP_PKEY_verify_recover_init(ctx.get()) > 0 &&
+         EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_NO_PADDING) > 0 &&
+         EVP_PKEY_verify_recover(ctx.get(), out.data(), &out_size, in.data(),
+                                 size) > 0;
+}
+
+// Encrypts and decrypts single blocks with one key.
+//
+// The EVP_PKEY_CTXs for both directions are set up once in the constructor
+// with the padding mode and OAEP digest, and the key is validated there too,
+// so Encrypt() and Decrypt() go straight to the cached contexts. A Cryptor
+// must not be used from several threads at once; see BatchCryptor.
 class Cryptor {
  public:
   Cryptor(Key key) : Cryptor(std::move(key), DefaultCryptoOption()) {}
 
   Cryptor(Key key, CryptoOption option)
-      : key_(std::move(key)), option_(std::move(option)) {}
+      : key_(std::move(key)),
+        option_(std::move(option)),
+        key_size_(-1),
+        padding_size_(GetPaddingSize(option_)),
+        pkey_(nullptr, EVP_PKEY_free),
+        encrypt_ctx_(nullptr, EVP_PKEY_CTX_free),
+        decrypt_ctx_(nullptr, EVP_PKEY_CTX_free) {
+    if (!key_) {
+      init_error_ = "Invalid key.";
+      return;
+    }
+    key_size_ = key_.size();
+    pkey_ = NewEVPPKey(key_);
+    if (!pkey_) {
+      init_error_ = "Failed to create EVP_PKEY.";
+      return;
+    }
+    // Raw encryption by private key and decryption by public key are what
+    // EVP calls signing and verify-recover without a digest.
+    if (key_.type() == Key::Type::kPrivate) {
+      if (option_.padding_mode != PaddingMode::kOAEP) {
+        encrypt_ctx_ = NewContext(EVP_PKEY_sign_init);
+      }
+      decrypt_ctx_ = NewContext(EVP_PKEY_decrypt_init);
+    } else {
+      encrypt_ctx_ = NewContext(EVP_PKEY_encrypt_init);
+      if (option_.padding_mode != PaddingMode::kOAEP) {
+        decrypt_ctx_ = NewContext(EVP_PKEY_verify_recover_init);
+      }
+    }
+  }
 
   bool IsValid() {
-    if (!key_) {
-      last_error_ = "Invalid key.";
+    if (!init_error_.empty()) {
+      last_error_ = init_error_;
       return false;
     }
     return true;
@@ -95,7 +202,7 @@ class Cryptor {
       last_error_ = "Invalid key.";
       return -1;
     }
-    return key_.size() - GetPaddingSize(option_);
+    return key_size_ - padding_size_;
   }
 
   int GetMaxDecryptableBufferSize() {
@@ -103,12 +210,12 @@ class Cryptor {
       last_error_ = "Invalid key.";
       return -1;
     }
-    return key_.size();
+    return key_size_;
   }
 
-  int GetOutputBufferSizeForEncryption() { return key_.size(); }
+  int GetOutputBufferSizeForEncryption() { return key_size_; }
 
-  int GetOutputBufferSizeForDecryption() { return key_.size(); }
+  int GetOutputBufferSizeForDecryption() { return key_size_; }
 
   template <class SrcBuffer, class DstBuffer>
   int Encrypt(const SrcBuffer &src, DstBuffer &dst) {
@@ -119,38 +226,35 @@ class Cryptor {
 
   int Encrypt(const unsigned char *src_buf, int src_buf_size,
               unsigned char *dst_buf, int dst_buf_size) {
-    if (!IsValid()) {
-      return -1;
-    }
-    if (key_.type() == Key::Type::kPrivate &&
-        option_.padding_mode == PaddingMode::kOAEP) {
+    if (!encrypt_ctx_) {
+      if (!IsValid()) {
+        return -1;
+      }
       last_error_ = "OAEP cannot be used for encyption by private key.";
       return -1;
     }
-
-    if (src_buf_size > GetMaxEncryptableBufferSize()) {
+    if (src_buf_size > key_size_ - padding_size_) {
       last_error_ = "Too large input buffer size.";
       return -1;
     }
-    if (dst_buf_size < GetOutputBufferSizeForEncryption()) {
+    if (dst_buf_size < key_size_) {
       last_error_ = "Too small output buffer size.";
       return -1;
     }
-    int encrypted_size;
+    size_t encrypted_size = dst_buf_size;
+    int ret;
     if (key_.type() == Key::Type::kPrivate) {
-      encrypted_size =
-          RSA_private_encrypt(src_buf_size, src_buf, dst_buf, key_,
-                              static_cast<int>(option_.padding_mode));
+      ret = EVP_PKEY_sign(encrypt_ctx_.get(), dst_buf, &encrypted_size,
+                          src_buf, src_buf_size);
     } else {
-      encrypted_size =
-          RSA_public_encrypt(src_buf_size, src_buf, dst_buf, key_,
-                             static_cast<int>(option_.padding_mode));
+      ret = EVP_PKEY_encrypt(encrypt_ctx_.get(), dst_buf, &encrypted_size,
+                             src_buf, src_buf_size);
     }
-    if (encrypted_size == -1) {
+    if (ret <= 0) {
       last_error_ = "Failed to encrypt.";
       return -1;
     }
-    return encrypted_size;
+    return static_cast<int>(encrypted_size);
   }
 
   template <class SrcBuffer, class DstBuffer>
@@ -162,45 +266,78 @@ class Cryptor {
 
   int Decrypt(const unsigned char *src_buf, int src_buf_size,
               unsigned char *dst_buf, int dst_buf_size) {
-    if (!IsValid()) {
-      return -1;
-    }
-    if (key_.type() == Key::Type::kPublic &&
-        option_.padding_mode == PaddingMode::kOAEP) {
+    if (!decrypt_ctx_) {
+      if (!IsValid()) {
+        return -1;
+      }
       last_error_ = "OAEP cannot be used for decyption by public key.";
       return -1;
     }
-
-    if (src_buf_size > GetMaxDecryptableBufferSize()) {
+    if (src_buf_size > key_size_) {
       last_error_ = "Too large input buffer size.";
       return -1;
     }
-    if (dst_buf_size < GetOutputBufferSizeForDecryption()) {
+    if (dst_buf_size < key_size_) {
       last_error_ = "Too small output buffer size.";
       return -1;
     }
-    int decrypted_size;
+    size_t decrypted_size = dst_buf_size;
+    int ret;
     if (key_.type() == Key::Type::kPrivate) {
-      decrypted_size =
-          RSA_private_decrypt(src_buf_size, src_buf, dst_buf, key_,
-                              static_cast<int>(option_.padding_mode));
+      ret = EVP_PKEY_decrypt(decrypt_ctx_.get(), dst_buf, &decrypted_size,
+                             src_buf, src_buf_size);
     } else {
-      decrypted_size =
-          RSA_public_decrypt(src_buf_size, src_buf, dst_buf, key_,
-                             static_cast<int>(option_.padding_mode));
+      ret = EVP_PKEY_verify_recover(decrypt_ctx_.get(), dst_buf,
+                                    &decrypted_size, src_buf, src_buf_size);
     }
-    if (decrypted_size == -1) {
+    if (ret <= 0) {
       last_error_ = "Failed to decrypt.";
       return -1;
     }
-    return decrypted_size;
+    return static_cast<int>(decrypted_size);
+  }
+
+  // See rsa::WarmUp(). BatchCryptor calls this for its copies of the key.
+  bool WarmUp() {
+    if (!IsValid()) {
+      return false;
+    }
+    if (!rsa::WarmUp(pkey_.get(), key_.type())) {
+      last_error_ = "Failed to warm up the key.";
+      return false;
+    }
+    return true;
   }
 
   const std::string &last_error() const { return last_error_; }
 
  private:
+  EVPPKeyCtxPtr NewContext(int (*init)(EVP_PKEY_CTX *)) {
+    EVPPKeyCtxPtr ctx(EVP_PKEY_CTX_new(pkey_.get(), nullptr),
+                      EVP_PKEY_CTX_free);
+    if (!ctx || init(ctx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_rsa_padding(
+            ctx.get(), static_cast<int>(option_.padding_mode)) <= 0) {
+      init_error_ = "Failed to set up EVP_PKEY_CTX.";
+      return EVPPKeyCtxPtr(nullptr, EVP_PKEY_CTX_free);
+    }
+    if (option_.padding_mode == PaddingMode::kOAEP && option_.md != nullptr &&
+        (EVP_PKEY_CTX_set_rsa_oaep_md(ctx.get(), option_.md) <= 0 ||
+         EVP_PKEY_CTX_set_rsa_mgf1_md(ctx.get(), option_.md) <= 0)) {
+      init_error_ = "Failed to set the OAEP digest.";
+      return EVPPKeyCtxPtr(nullptr, EVP_PKEY_CTX_free);
+    }
+    return ctx;
+  }
+
   Key key_;
   CryptoOption option_;
+  int key_size_;
+  int padding_size_;
+  EVPPKeyPtr pkey_;
+  EVPPKeyCtxPtr encrypt_ctx_;
+  EVPPKeyCtxPtr decrypt_ctx_;
+  std::string init_error_;
   std::string last_error_;
 };
 
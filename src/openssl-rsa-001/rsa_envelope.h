@@ -0,0 +1,230 @@
+#ifndef RSA_ENVELOPE_H_
+#define RSA_ENVELOPE_H_
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "openssl/crypto.h"
+#include "openssl/evp.h"
+#include "openssl/rand.h"
+
+#include "rsa_cryptor.h"
+
+namespace rsa {
+
+// Hybrid encryption for payloads of any size. A random AES-256-GCM key is
+// wrapped with RSA-OAEP once, and the body is encrypted with it in as many
+// Update() calls as needed, so memory use does not depend on the payload
+// size.
+//
+// Envelope layout:
+//
+//   | version (1 byte) | wrapped key size (2 bytes, big endian) |
+//   | wrapped key | IV (12 bytes) | ciphertext ... | tag (16 bytes) |
+//
+// The header (everything before the ciphertext) is authenticated as GCM
+// additional data. The version names the key wrap and the cipher; an opener
+// rejects any version it does not know.
+namespace envelope {
+
+// RSA-OAEP with SHA-256 and AES-256-GCM. The top bit is set so that
+// envelopes from before the version byte, which start with the high byte of
+// the wrapped key size, are rejected as an unknown version too.
+constexpr unsigned char kVersion = 0x81;
+constexpr int kPrefixSize = 3;
+constexpr int kKeySize = 32;
+constexpr int kIvSize = 12;
+constexpr int kTagSize = 16;
+
+// Returns the header size given its first kPrefixSize bytes.
+inline int HeaderSize(const unsigned char *prefix) {
+  return kPrefixSize + ((prefix[1] << 8) | prefix[2]) + kIvSize;
+}
+
+using CipherCtxPtr =
+    std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>;
+
+// OAEP with SHA-256 for both the label hash and MGF1.
+inline CryptoOption WrapOption() {
+  return {PaddingMode::kOAEP, EVP_sha256()};
+}
+
+}  // namespace envelope
+
+class EnvelopeSealer {
+ public:
+  explicit EnvelopeSealer(Key public_key)
+      : cryptor_(std::move(public_key), envelope::WrapOption()),
+        ctx_(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free) {}
+
+  // Starts a new envelope with a fresh key and IV, and stores its header in
+  // |header|.
+  bool Init(std::string *header) {
+    unsigned char key[envelope::kKeySize];
+    unsigned char iv[envelope::kIvSize];
+    if (RAND_bytes(key, sizeof(key)) != 1 || RAND_bytes(iv, sizeof(iv)) != 1) {
+      last_error_ = "Failed to generate a key.";
+      return false;
+    }
+
+    std::string wrapped(cryptor_.GetOutputBufferSizeForEncryption(), 0);
+    int wrapped_size = cryptor_.Encrypt(
+        key, sizeof(key), reinterpret_cast<unsigned char *>(&wrapped[0]),
+        wrapped.size());
+    if (wrapped_size < 0) {
+      OPENSSL_cleanse(key, sizeof(key));
+      last_error_ = "Failed to wrap the key: " + cryptor_.last_error();
+      return false;
+    }
+    wrapped.resize(wrapped_size);
+
+    header->clear();
+    header->push_back(static_cast<char>(envelope::kVersion));
+    header->push_back(static_cast<char>(wrapped_size >> 8));
+    header->push_back(static_cast<char>(wrapped_size & 0xff));
+    header->append(wrapped);
+    header->append(reinterpret_cast<const char *>(iv), sizeof(iv));
+
+    int ok = EVP_EncryptInit_ex(ctx_.get(), EVP_aes_256_gcm(), nullptr,
+                                nullptr, nullptr) == 1 &&
+             EVP_CIPHER_CTX_ctrl(ctx_.get(), EVP_CTRL_GCM_SET_IVLEN,
+                                 sizeof(iv), nullptr) == 1 &&
+             EVP_EncryptInit_ex(ctx_.get(), nullptr, nullptr, key, iv) == 1;
+    OPENSSL_cleanse(key, sizeof(key));
+    int aad_size;
+    if (!ok ||
+        EVP_EncryptUpdate(ctx_.get(), nullptr, &aad_size,
+                          reinterpret_cast<const unsigned char *>(
+                              header->data()),
+                          header->size()) != 1) {
+      last_error_ = "Failed to initialize the cipher.";
+      return false;
+    }
+    return true;
+  }
+
+  // Encrypts |src_buf_size| bytes into |dst_buf|, which must be at least as
+  // large. Returns the number of bytes written, or -1.
+  int Update(const unsigned char *src_buf, int src_buf_size,
+             unsigned char *dst_buf) {
+    int size;
+    if (EVP_EncryptUpdate(ctx_.get(), dst_buf, &size, src_buf, src_buf_size) !=
+        1) {
+      last_error_ = "Failed to encrypt.";
+      return -1;
+    }
+    return size;
+  }
+
+  // Finishes the envelope and writes envelope::kTagSize bytes into |tag|.
+  bool Final(unsigned char *tag) {
+    // GCM does not buffer, so nothing is written here.
+    unsigned char unused[EVP_MAX_BLOCK_LENGTH];
+    int size;
+    if (EVP_EncryptFinal_ex(ctx_.get(), unused, &size) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx_.get(), EVP_CTRL_GCM_GET_TAG,
+                            envelope::kTagSize, tag) != 1) {
+      last_error_ = "Failed to finalize.";
+      return false;
+    }
+    return true;
+  }
+
+  const std::string &last_error() const { return last_error_; }
+
+ private:
+  Cryptor cryptor_;
+  envelope::CipherCtxPtr ctx_;
+  std::string last_error_;
+};
+
+class EnvelopeOpener {
+ public:
+  explicit EnvelopeOpener(Key private_key)
+      : cryptor_(std::move(private_key), envelope::WrapOption()),
+        ctx_(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free) {}
+
+  // Reads the header from the start of an envelope. Returns the header size
+  // once |buf| holds all of it, 0 if more bytes are needed, or -1 on error.
+  int Init(const unsigned char *buf, int buf_size) {
+    if (buf_size < envelope::kPrefixSize) {
+      return 0;
+    }
+    if (buf[0] != envelope::kVersion) {
+      last_error_ = "Unsupported envelope version.";
+      return -1;
+    }
+    int header_size = envelope::HeaderSize(buf);
+    int wrapped_size = header_size - envelope::kPrefixSize - envelope::kIvSize;
+    if (buf_size < header_size) {
+      return 0;
+    }
+
+    unsigned char key[envelope::kKeySize];
+    std::string unwrapped(cryptor_.GetOutputBufferSizeForDecryption(), 0);
+    int key_size = cryptor_.Decrypt(
+        buf + envelope::kPrefixSize, wrapped_size,
+        reinterpret_cast<unsigned char *>(&unwrapped[0]), unwrapped.size());
+    if (key_size != envelope::kKeySize) {
+      OPENSSL_cleanse(&unwrapped[0], unwrapped.size());
+      last_error_ = "Failed to unwrap the key: " + cryptor_.last_error();
+      return -1;
+    }
+    std::copy(unwrapped.begin(), unwrapped.begin() + key_size, key);
+    OPENSSL_cleanse(&unwrapped[0], unwrapped.size());
+
+    const unsigned char *iv = buf + envelope::kPrefixSize + wrapped_size;
+    int ok = EVP_DecryptInit_ex(ctx_.get(), EVP_aes_256_gcm(), nullptr,
+                                nullptr, nullptr) == 1 &&
+             EVP_CIPHER_CTX_ctrl(ctx_.get(), EVP_CTRL_GCM_SET_IVLEN,
+                                 envelope::kIvSize, nullptr) == 1 &&
+             EVP_DecryptInit_ex(ctx_.get(), nullptr, nullptr, key, iv) == 1;
+    OPENSSL_cleanse(key, sizeof(key));
+    int aad_size;
+    if (!ok || EVP_DecryptUpdate(ctx_.get(), nullptr, &aad_size, buf,
+                                 header_size) != 1) {
+      last_error_ = "Failed to initialize the cipher.";
+      return -1;
+    }
+    return header_size;
+  }
+
+  // Decrypts |src_buf_size| bytes into |dst_buf|, which must be at least as
+  // large. The output must not be trusted before Final() succeeds.
+  int Update(const unsigned char *src_buf, int src_buf_size,
+             unsigned char *dst_buf) {
+    int size;
+    if (EVP_DecryptUpdate(ctx_.get(), dst_buf, &size, src_buf, src_buf_size) !=
+        1) {
+      last_error_ = "Failed to decrypt.";
+      return -1;
+    }
+    return size;
+  }
+
+  // Checks the envelope::kTagSize bytes of |tag| that end the envelope.
+  bool Final(const unsigned char *tag) {
+    unsigned char unused[EVP_MAX_BLOCK_LENGTH];
+    int size;
+    if (EVP_CIPHER_CTX_ctrl(ctx_.get(), EVP_CTRL_GCM_SET_TAG,
+                            envelope::kTagSize,
+                            const_cast<unsigned char *>(tag)) != 1 ||
+        EVP_DecryptFinal_ex(ctx_.get(), unused, &size) != 1) {
+      last_error_ = "Authentication failed.";
+      return false;
+    }
+    return true;
+  }
+
+  const std::string &last_error() const { return last_error_; }
+
+ private:
+  Cryptor cryptor_;
+  envelope::CipherCtxPtr ctx_;
+  std::string last_error_;
+};
+
+}  // namespace rsa
+
+#endif  // RSA_ENVELOPE_H_
@@ -0,0 +1,341 @@
+#ifndef RSA_KEY_STORE_H_
+#define RSA_KEY_STORE_H_
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "openssl/crypto.h"
+#include "openssl/evp.h"
+#include "openssl/pem.h"
+#include "openssl/rsa.h"
+#include "openssl/x509.h"
+
+#include "rsa_cryptor.h"
+#include "thread_pool.h"
+
+namespace rsa {
+
+// Holds key pairs by fingerprint, the hex SHA-256 of the DER public key.
+//
+// A key pair is loaded from |prefix|public.pem, |prefix|private.pem and
+// |prefix|passphrase, the same files openssl-rsa-001 takes. Decrypting the
+// private PEM (a passphrase KDF plus parsing) is by far the slowest step, so
+// decrypted keys are also kept in DER form keyed by the hash of their PEM
+// file and passphrase. Loading an unchanged file again, e.g. when keys are
+// rotated, then only costs a DER parse.
+//
+// Every loaded key also gets an EVP_PKEY, warmed up with one raw operation
+// so that its Montgomery contexts and blinding are ready before the first
+// real use. Keys from GetKey() carry that EVP_PKEY, so Cryptors, Signers and
+// Verifiers made from them share the warmed state. Key::Duplicate() copies
+// do not; BatchCryptor and BatchVerifier warm up their own.
+//
+// All methods are thread-safe. Keys are handed out as shared RSAPtrs and stay
+// valid after they are removed from the store.
+class KeyStore {
+ public:
+  struct KeyPair {
+    RSAPtr public_rsa;
+    RSAPtr private_rsa;
+    EVPPKeySharedPtr public_pkey;
+    EVPPKeySharedPtr private_pkey;
+    // The der_cache_ entry of the private key.
+    std::string pem_hash;
+  };
+
+  explicit KeyStore(int num_threads) : pool_(num_threads) {}
+
+  KeyStore(const KeyStore &) = delete;
+  KeyStore &operator=(const KeyStore &) = delete;
+
+  ~KeyStore() {
+    for (auto &p : der_cache_) {
+      Cleanse(&p.second);
+    }
+  }
+
+  // Loads one key pair and stores its fingerprint into |fingerprint|.
+  bool Load(const std::string &prefix, std::string *fingerprint) {
+    std::string error;
+    if (!LoadOne(prefix, fingerprint, &error)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      last_error_ = error;
+      return false;
+    }
+    return true;
+  }
+
+  // Loads all |prefixes| in parallel. fingerprints[i] is left empty if the
+  // i-th one failed. Returns the number of failures; last_error() describes
+  // one of them. Concurrent calls take turns, since they share one pool.
+  int LoadAll(const std::vector<std::string> &prefixes,
+              std::vector<std::string> *fingerprints) {
+    // ThreadPool runs one ParallelFor at a time.
+    std::lock_guard<std::mutex> pool_lock(pool_mutex_);
+    fingerprints->assign(prefixes.size(), std::string());
+    int failures = 0;
+    pool_.ParallelFor(prefixes.size(),
+                      [&](int /* worker */, size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; i++) {
+                          std::string error;
+                          if (!LoadOne(prefixes[i], &(*fingerprints)[i],
+                                       &error)) {
+                            std::lock_guard<std::mutex> lock(mutex_);
+                            failures++;
+                            last_error_ = error;
+                          }
+                        }
+                      });
+    return failures;
+  }
+
+  RSAPtr GetPublic(const std::string &fingerprint) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = keys_.find(fingerprint);
+    return it != keys_.end() ? it->second.public_rsa : nullptr;
+  }
+
+  RSAPtr GetPrivate(const std::string &fingerprint) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = keys_.find(fingerprint);
+    return it != keys_.end() ? it->second.private_rsa : nullptr;
+  }
+
+  // Returns the key with its warmed-up EVP_PKEY, or an invalid Key if
+  // |fingerprint| is unknown.
+  Key GetKey(const std::string &fingerprint, Key::Type type) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = keys_.find(fingerprint);
+    if (it == keys_.end()) {
+      return Key(nullptr, type);
+    }
+    const KeyPair &pair = it->second;
+    return type == Key::Type::kPrivate
+               ? Key(pair.private_rsa, type, pair.private_pkey)
+               : Key(pair.public_rsa, type, pair.public_pkey);
+  }
+
+  // Also drops the cached DER of the private key, so that a removed key does
+  // not stay in memory in the clear.
+  bool Remove(const std::string &fingerprint) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = keys_.find(fingerprint);
+    if (it == keys_.end()) {
+      return false;
+    }
+    EraseDer(it->second.pem_hash);
+    keys_.erase(it);
+    return true;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return keys_.size();
+  }
+
+  std::string last_error() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_error_;
+  }
+
+  // Returns the hex SHA-256 of the DER SubjectPublicKeyInfo of |rsa|, or an
+  // empty string on failure.
+  static std::string Fingerprint(RSA *rsa) {
+    unsigned char *der = nullptr;
+    int der_size = i2d_RSA_PUBKEY(rsa, &der);
+    if (der_size <= 0) {
+      return std::string();
+    }
+    std::string digest = Sha256(der, der_size);
+    OPENSSL_free(der);
+    return ToHex(digest);
+  }
+
+ private:
+  static bool ReadFile(const std::string &path, std::string *content) {
+    // Unlike shared_ptr, unique_ptr does not call fclose on null.
+    std::unique_ptr<FILE, decltype(&fclose)> fp(fopen(path.c_str(), "rb"),
+                                                fclose);
+    if (!fp) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fileno(fp.get()), &st) != 0) {
+      return false;
+    }
+    content->resize(st.st_size);
+    if (st.st_size == 0) {
+      return true;
+    }
+    return fread(&(*content)[0], 1, content->size(), fp.get()) ==
+           content->size();
+  }
+
+  static std::string Sha256(const void *data, size_t size) {
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int md_size = 0;
+    if (EVP_Digest(data, size, md, &md_size, EVP_sha256(), nullptr) != 1) {
+      return std::string();
+    }
+    return std::string(reinterpret_cast<const char *>(md), md_size);
+  }
+
+  static std::string ToHex(const std::string &bytes) {
+    static const char kDigits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+    for (unsigned char c : bytes) {
+      hex.push_back(kDigits[c >> 4]);
+      hex.push_back(kDigits[c & 0xf]);
+    }
+    return hex;
+  }
+
+  static void Cleanse(std::string *s) {
+    if (!s->empty()) {
+      OPENSSL_cleanse(&(*s)[0], s->size());
+    }
+  }
+
+  // Returns a warmed-up EVP_PKEY of |key|, or null.
+  static EVPPKeySharedPtr NewWarmEVPPKey(const Key &key) {
+    EVPPKeySharedPtr pkey(NewEVPPKey(key).release(), EVP_PKEY_free);
+    if (!pkey || !WarmUp(pkey.get(), key.type())) {
+      return nullptr;
+    }
+    return pkey;
+  }
+
+  // |pem_hash| receives the der_cache_ key of the private key.
+  RSAPtr ParsePrivate(const std::string &pem, const std::string &passphrase,
+                      std::string *pem_hash, std::string *error) {
+    // The passphrase is part of the cache key, so a wrong one still fails.
+    *pem_hash = Sha256(pem.data(), pem.size()) +
+                Sha256(passphrase.data(), passphrase.size());
+    std::string der;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = der_cache_.find(*pem_hash);
+      if (it != der_cache_.end()) {
+        der = it->second;
+      }
+    }
+    if (!der.empty()) {
+      const unsigned char *p = reinterpret_cast<const unsigned char *>(&der[0]);
+      RSAPtr rsa = Wrap(d2i_RSAPrivateKey(nullptr, &p, der.size()));
+      OPENSSL_cleanse(&der[0], der.size());
+      if (!rsa) {
+        *error = "Failed to parse cached private key.";
+      }
+      return rsa;
+    }
+
+    std::shared_ptr<BIO> bio(BIO_new_mem_buf(pem.data(), pem.size()),
+                             BIO_free);
+    RSAPtr rsa = Wrap(PEM_read_bio_RSAPrivateKey(
+        bio.get(), nullptr, nullptr, const_cast<char *>(passphrase.c_str())));
+    if (!rsa) {
+      *error = "Failed to parse private key.";
+      return nullptr;
+    }
+    unsigned char *buf = nullptr;
+    int der_size = i2d_RSAPrivateKey(rsa.get(), &buf);
+    if (der_size > 0) {
+      der.assign(reinterpret_cast<const char *>(buf), der_size);
+      OPENSSL_clear_free(buf, der_size);
+      std::lock_guard<std::mutex> lock(mutex_);
+      der_cache_[*pem_hash].swap(der);
+    }
+    return rsa;
+  }
+
+  bool LoadOne(const std::string &prefix, std::string *fingerprint,
+               std::string *error) {
+    std::string public_pem, private_pem, passphrase;
+    if (!ReadFile(prefix + "public.pem", &public_pem)) {
+      *error = "Failed to load " + prefix + "public.pem";
+      return false;
+    }
+    if (!ReadFile(prefix + "private.pem", &private_pem)) {
+      *error = "Failed to load " + prefix + "private.pem";
+      return false;
+    }
+    if (!ReadFile(prefix + "passphrase", &passphrase)) {
+      *error = "Failed to load " + prefix + "passphrase";
+      return false;
+    }
+    // Only the first line is the passphrase.
+    passphrase = passphrase.substr(0, passphrase.find('\n'));
+
+    KeyPair pair;
+    {
+      std::shared_ptr<BIO> bio(
+          BIO_new_mem_buf(public_pem.data(), public_pem.size()), BIO_free);
+      pair.public_rsa = Wrap(
+          PEM_read_bio_RSA_PUBKEY(bio.get(), nullptr, nullptr, nullptr));
+      if (!pair.public_rsa) {
+        *error = "Failed to parse public key of " + prefix;
+        return false;
+      }
+    }
+    pair.private_rsa =
+        ParsePrivate(private_pem, passphrase, &pair.pem_hash, error);
+    OPENSSL_cleanse(&passphrase[0], passphrase.size());
+    if (!pair.private_rsa) {
+      *error += " (" + prefix + ")";
+      return false;
+    }
+
+    std::string fp = Fingerprint(pair.public_rsa.get());
+    if (fp.empty() || fp != Fingerprint(pair.private_rsa.get())) {
+      *error = "Public and private keys of " + prefix + " do not match.";
+      return false;
+    }
+    pair.public_pkey =
+        NewWarmEVPPKey(Key(pair.public_rsa, Key::Type::kPublic));
+    pair.private_pkey =
+        NewWarmEVPPKey(Key(pair.private_rsa, Key::Type::kPrivate));
+    if (!pair.public_pkey || !pair.private_pkey) {
+      *error = "Failed to warm up keys of " + prefix;
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = keys_.find(fp);
+    if (it != keys_.end() && it->second.pem_hash != pair.pem_hash) {
+      // The same key from another file; its old DER is not needed anymore.
+      EraseDer(it->second.pem_hash);
+    }
+    keys_[fp] = pair;
+    *fingerprint = fp;
+    return true;
+  }
+
+  // Needs mutex_.
+  void EraseDer(const std::string &pem_hash) {
+    auto it = der_cache_.find(pem_hash);
+    if (it != der_cache_.end()) {
+      Cleanse(&it->second);
+      der_cache_.erase(it);
+    }
+  }
+
+  ThreadPool pool_;
+  // Held by LoadAll() while it uses pool_.
+  std::mutex pool_mutex_;
+  mutable std::mutex mutex_;
+  std::map<std::string, KeyPair> keys_;
+  // Hash of a private PEM file and its passphrase -> the decrypted DER.
+  std::map<std::string, std::string> der_cache_;
+  std::string last_error_;
+};
+
+}  // namespace rsa
+
+#endif  // RSA_KEY_STORE_H_
@@ -0,0 +1,254 @@
+#ifndef RSA_SIGNER_H_
+#define RSA_SIGNER_H_
+
+#include <memory>
+#include <string>
+
+#include "openssl/evp.h"
+#include "openssl/rsa.h"
+
+#include "rsa_cryptor.h"
+
+namespace rsa {
+
+enum class SignaturePadding {
+  kPSS = RSA_PKCS1_PSS_PADDING,
+  kV1_5 = RSA_PKCS1_PADDING,
+};
+
+struct SignOption {
+  SignaturePadding padding;
+  // SHA-256 if null. Also used for MGF1 and as the PSS salt length.
+  const EVP_MD *md;
+};
+
+constexpr SignOption DefaultSignOption() {
+  return {SignaturePadding::kPSS, nullptr};
+}
+
+using EVPMDCtxPtr = std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>;
+
+namespace signature {
+
+// Sets up |ctx| for signing (or verifying) with |pkey| and |option|, which
+// is the expensive part of starting a signature.
+inline bool InitContext(EVP_MD_CTX *ctx, EVP_PKEY *pkey,
+                        const SignOption &option, bool sign) {
+  const EVP_MD *md = option.md != nullptr ? option.md : EVP_sha256();
+  EVP_PKEY_CTX *pctx = nullptr;
+  int ret = sign ? EVP_DigestSignInit(ctx, &pctx, md, nullptr, pkey)
+                 : EVP_DigestVerifyInit(ctx, &pctx, md, nullptr, pkey);
+  if (ret != 1 || EVP_PKEY_CTX_set_rsa_padding(
+                      pctx, static_cast<int>(option.padding)) <= 0) {
+    return false;
+  }
+  if (option.padding == SignaturePadding::kPSS &&
+      (EVP_PKEY_CTX_set_rsa_pss_saltlen(pctx, RSA_PSS_SALTLEN_DIGEST) <= 0 ||
+       EVP_PKEY_CTX_set_rsa_mgf1_md(pctx, md) <= 0)) {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace signature
+
+// Signs messages with a private key. A message is hashed incrementally by
+// Init(), any number of Update() calls and Final(), or at once by Sign().
+//
+// The digest and padding are configured once into a template context, and
+// every Init() just copies it, so signing many small messages does not pay
+// for the setup each time. Not thread-safe.
+class Signer {
+ public:
+  explicit Signer(Key private_key)
+      : Signer(std::move(private_key), DefaultSignOption()) {}
+
+  Signer(Key private_key, SignOption option)
+      : key_(std::move(private_key)),
+        pkey_(NewEVPPKey(key_)),
+        template_ctx_(EVP_MD_CTX_new(), EVP_MD_CTX_free),
+        ctx_(EVP_MD_CTX_new(), EVP_MD_CTX_free) {
+    if (!pkey_ || key_.type() != Key::Type::kPrivate) {
+      init_error_ = "Invalid key.";
+      return;
+    }
+    if (!template_ctx_ || !ctx_ ||
+        !signature::InitContext(template_ctx_.get(), pkey_.get(), option,
+                                true)) {
+      init_error_ = "Failed to set up the signing context.";
+    }
+  }
+
+  bool IsValid() {
+    if (!init_error_.empty()) {
+      last_error_ = init_error_;
+      return false;
+    }
+    return true;
+  }
+
+  int GetSignatureSize() { return key_ ? key_.size() : -1; }
+
+  // Starts a new message.
+  bool Init() {
+    if (!IsValid()) {
+      return false;
+    }
+    if (EVP_MD_CTX_copy_ex(ctx_.get(), template_ctx_.get()) != 1) {
+      last_error_ = "Failed to start a message.";
+      return false;
+    }
+    return true;
+  }
+
+  bool Update(const void *data, size_t size) {
+    if (EVP_DigestSignUpdate(ctx_.get(), data, size) != 1) {
+      last_error_ = "Failed to hash.";
+      return false;
+    }
+    return true;
+  }
+
+  // Writes the signature of the message into |sig_buf|, which must be at
+  // least GetSignatureSize() bytes. Returns the signature size, or -1.
+  int Final(unsigned char *sig_buf, int sig_buf_size) {
+    if (sig_buf_size < GetSignatureSize()) {
+      last_error_ = "Too small output buffer size.";
+      return -1;
+    }
+    size_t sig_size = sig_buf_size;
+    if (EVP_DigestSignFinal(ctx_.get(), sig_buf, &sig_size) != 1) {
+      last_error_ = "Failed to sign.";
+      return -1;
+    }
+    return static_cast<int>(sig_size);
+  }
+
+  int Sign(const unsigned char *buf, int buf_size, unsigned char *sig_buf,
+           int sig_buf_size) {
+    if (!Init() || !Update(buf, buf_size)) {
+      return -1;
+    }
+    return Final(sig_buf, sig_buf_size);
+  }
+
+  template <class Buffer, class SigBuffer>
+  int Sign(const Buffer &buf, SigBuffer &sig) {
+    return Sign(
+        reinterpret_cast<const unsigned char *>(&buf[0]), container_sizeof(buf),
+        reinterpret_cast<unsigned char *>(&sig[0]), container_sizeof(sig));
+  }
+
+  const std::string &last_error() const { return last_error_; }
+
+ private:
+  Key key_;
+  EVPPKeyPtr pkey_;
+  EVPMDCtxPtr template_ctx_;
+  EVPMDCtxPtr ctx_;
+  std::string init_error_;
+  std::string last_error_;
+};
+
+// Checks signatures made by Signer with the same SignOption. See Signer for
+// how the contexts are reused. Not thread-safe; see BatchVerifier.
+class Verifier {
+ public:
+  explicit Verifier(Key public_key)
+      : Verifier(std::move(public_key), DefaultSignOption()) {}
+
+  Verifier(Key public_key, SignOption option)
+      : key_(std::move(public_key)),
+        pkey_(NewEVPPKey(key_)),
+        template_ctx_(EVP_MD_CTX_new(), EVP_MD_CTX_free),
+        ctx_(EVP_MD_CTX_new(), EVP_MD_CTX_free) {
+    if (!pkey_) {
+      init_error_ = "Invalid key.";
+      return;
+    }
+    if (!template_ctx_ || !ctx_ ||
+        !signature::InitContext(template_ctx_.get(), pkey_.get(), option,
+                                false)) {
+      init_error_ = "Failed to set up the verification context.";
+    }
+  }
+
+  bool IsValid() {
+    if (!init_error_.empty()) {
+      last_error_ = init_error_;
+      return false;
+    }
+    return true;
+  }
+
+  // Starts a new message.
+  bool Init() {
+    if (!IsValid()) {
+      return false;
+    }
+    if (EVP_MD_CTX_copy_ex(ctx_.get(), template_ctx_.get()) != 1) {
+      last_error_ = "Failed to start a message.";
+      return false;
+    }
+    return true;
+  }
+
+  bool Update(const void *data, size_t size) {
+    if (EVP_DigestVerifyUpdate(ctx_.get(), data, size) != 1) {
+      last_error_ = "Failed to hash.";
+      return false;
+    }
+    return true;
+  }
+
+  // Returns true if |sig_buf| is a valid signature of the message.
+  bool Final(const unsigned char *sig_buf, int sig_buf_size) {
+    if (EVP_DigestVerifyFinal(ctx_.get(), sig_buf, sig_buf_size) != 1) {
+      last_error_ = "Invalid signature.";
+      return false;
+    }
+    return true;
+  }
+
+  bool Verify(const unsigned char *buf, int buf_size,
+              const unsigned char *sig_buf, int sig_buf_size) {
+    if (!Init() || !Update(buf, buf_size)) {
+      return false;
+    }
+    return Final(sig_buf, sig_buf_size);
+  }
+
+  template <class Buffer, class SigBuffer>
+  bool Verify(const Buffer &buf, const SigBuffer &sig) {
+    return Verify(
+        reinterpret_cast<const unsigned char *>(&buf[0]), container_sizeof(buf),
+        reinterpret_cast<const unsigned char *>(&sig[0]),
+        container_sizeof(sig));
+  }
+
+  // See rsa::WarmUp(). BatchVerifier calls this for its copies of the key.
+  bool WarmUp() {
+    if (!IsValid()) {
+      return false;
+    }
+    if (!rsa::WarmUp(pkey_.get(), Key::Type::kPublic)) {
+      last_error_ = "Failed to warm up the key.";
+      return false;
+    }
+    return true;
+  }
+
+  const std::string &last_error() const { return last_error_; }
+
+ private:
+  Key key_;
+  EVPPKeyPtr pkey_;
+  EVPMDCtxPtr template_ctx_;
+  EVPMDCtxPtr ctx_;
+  std::string init_error_;
+  std::string last_error_;
+};
+
+}  // namespace rsa
+
+#endif  // RSA_SIGNER_H_
@@ -0,0 +1,119 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rsa {
+
+// Fixed set of threads that run one ParallelFor at a time. Every thread has a
+// stable index in [0, size()), so callers can keep per-thread state such as
+// their own Cryptor.
+class ThreadPool {
+ public:
+  // fn(worker_index, begin, end) processes items [begin, end).
+  using RangeFunc = std::function<void(int worker, size_t begin, size_t end)>;
+
+  explicit ThreadPool(int num_threads)
+      : fn_(nullptr),
+        n_(0),
+        chunk_(0),
+        next_(0),
+        generation_(0),
+        busy_(0),
+        stopping_(false) {
+    // At least one thread, e.g. when hardware_concurrency() returned 0.
+    num_threads = std::max(1, num_threads);
+    for (int i = 0; i < num_threads; i++) {
+      threads_.emplace_back([this, i]() { Run(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto &t : threads_) {
+      t.join();
+    }
+  }
+
+  // Splits [0, n) into chunks that the threads pick up until none are left,
+  // and returns when all of them are done. Not reentrant.
+  void ParallelFor(size_t n, const RangeFunc &fn) {
+    if (n == 0) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    fn_ = &fn;
+    n_ = n;
+    // A few chunks per thread keeps them balanced when items differ in cost.
+    chunk_ = std::max<size_t>(1, n / (threads_.size() * 4));
+    next_.store(0);
+    busy_ = threads_.size();
+    generation_++;
+    start_cv_.notify_all();
+    done_cv_.wait(lock, [this]() { return busy_ == 0; });
+    fn_ = nullptr;
+  }
+
+  int size() const { return static_cast<int>(threads_.size()); }
+
+ private:
+  void Run(int index) {
+    uint64_t seen = 0;
+    for (;;) {
+      const RangeFunc *fn;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_cv_.wait(lock,
+                       [&]() { return stopping_ || generation_ != seen; });
+        if (stopping_) {
+          return;
+        }
+        seen = generation_;
+        fn = fn_;
+      }
+      for (;;) {
+        size_t begin = next_.fetch_add(chunk_);
+        if (begin >= n_) {
+          break;
+        }
+        (*fn)(index, begin, std::min(begin + chunk_, n_));
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_ == 0) {
+          done_cv_.notify_one();
+        }
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  const RangeFunc *fn_;
+  size_t n_;
+  size_t chunk_;
+  std::atomic<size_t> next_;
+  uint64_t generation_;
+  size_t busy_;
+  bool stopping_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace rsa
+
+#endif  // THREAD_POOL_H_
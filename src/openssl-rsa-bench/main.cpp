@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "openssl/bn.h"
+#include "openssl/rsa.h"
+
+#include "latency_histogram.h"
+#include "rsa_cryptor.h"
+#include "rsa_key_store.h"
+
+DEFINE_string(key_sizes, "2048,3072,4096",
+              "Comma separated sizes in bits of the keys to generate.");
+DEFINE_string(key_prefix, "",
+              "Use the key pair of this prefix (e.g. misc/keys/foo_) instead "
+              "of generated ones.");
+DEFINE_string(paddings, "oaep,v1_5", "Comma separated paddings: oaep, v1_5.");
+DEFINE_string(threads, "",
+              "Comma separated thread counts. Defaults to powers of two up to "
+              "the number of cores.");
+DEFINE_int32(duration_ms, 1000, "Run time of each case.");
+DEFINE_string(format, "csv", "Output format: csv or json (one per line).");
+
+using Clock = std::chrono::steady_clock;
+
+struct Case {
+  int key_bits;
+  std::string padding;
+  std::string op;
+  int threads;
+};
+
+struct Result {
+  Result() : errors(0), seconds(0) {}
+
+  LatencyHistogram latency;
+  uint64_t errors;
+  double seconds;
+};
+
+std::vector<std::string> Split(const std::string &s) {
+  std::vector<std::string> items;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+std::vector<int> ThreadCounts() {
+  std::vector<int> counts;
+  for (auto &s : Split(FLAGS_threads)) {
+    counts.push_back(std::max(1, std::stoi(s)));
+  }
+  if (counts.empty()) {
+    int n = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < n; i *= 2) {
+      counts.push_back(i);
+    }
+    counts.push_back(n);
+  }
+  return counts;
+}
+
+struct KeyPair {
+  rsa::RSAPtr public_rsa;
+  rsa::RSAPtr private_rsa;
+};
+
+KeyPair GenerateKeyPair(int bits) {
+  KeyPair pair;
+  std::shared_ptr<BIGNUM> e(BN_new(), BN_free);
+  rsa::RSAPtr rsa = rsa::Wrap(RSA_new());
+  if (!e || !rsa || BN_set_word(e.get(), RSA_F4) != 1 ||
+      RSA_generate_key_ex(rsa.get(), bits, e.get(), nullptr) != 1) {
+    return pair;
+  }
+  pair.private_rsa = rsa;
+  pair.public_rsa = rsa::Wrap(RSAPublicKey_dup(rsa.get()));
+  return pair;
+}
+
+// Runs |c.threads| threads for FLAGS_duration_ms, each with its own Cryptor
+// over its own copy of the key, and merges their latencies.
+Result Run(const KeyPair &pair, const Case &c) {
+  rsa::CryptoOption option = rsa::DefaultCryptoOption();
+  if (c.padding == "oaep") {
+    option.padding_mode = rsa::PaddingMode::kOAEP;
+  }
+  bool encrypt = c.op == "encrypt";
+  rsa::Key public_key(pair.public_rsa, rsa::Key::Type::kPublic);
+  rsa::Key private_key(pair.private_rsa, rsa::Key::Type::kPrivate);
+
+  // Decryption is measured on a ciphertext made once up front.
+  rsa::Cryptor setup(public_key.Duplicate(), option);
+  std::string plain(32, 'x');
+  std::string cipher(setup.GetOutputBufferSizeForEncryption(), 0);
+  int cipher_size = setup.Encrypt(plain, cipher);
+  cipher.resize(std::max(0, cipher_size));
+
+  std::vector<Result> results(c.threads);
+  std::atomic<int> ready(0);
+  std::atomic<bool> go(false);
+  Clock::time_point deadline;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < c.threads; i++) {
+    threads.emplace_back([&, i]() {
+      rsa::Cryptor cryptor(
+          encrypt ? public_key.Duplicate() : private_key.Duplicate(), option);
+      const std::string &src = encrypt ? plain : cipher;
+      std::string dst(cryptor.GetOutputBufferSizeForDecryption(), 0);
+      Result &result = results[i];
+      ready++;
+      while (!go) {
+        std::this_thread::yield();
+      }
+      auto start = Clock::now();
+      for (;;) {
+        auto t0 = Clock::now();
+        if (t0 >= deadline) {
+          break;
+        }
+        int size = encrypt ? cryptor.Encrypt(src, dst)
+                           : cryptor.Decrypt(src, dst);
+        if (size < 0) {
+          result.errors++;
+          continue;
+        }
+        result.latency.Record(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - t0)
+                .count());
+      }
+      result.seconds =
+          std::chrono::duration<double>(Clock::now() - start).count();
+    });
+  }
+  while (ready < c.threads) {
+    std::this_thread::yield();
+  }
+  deadline = Clock::now() + std::chrono::milliseconds(FLAGS_duration_ms);
+  go = true;
+
+  Result total;
+  for (int i = 0; i < c.threads; i++) {
+    threads[i].join();
+    total.latency.Merge(results[i].latency);
+    total.errors += results[i].errors;
+    total.seconds = std::max(total.seconds, results[i].seconds);
+  }
+  return total;
+}
+
+void Print(const Case &c, const Result &r) {
+  const LatencyHistogram &h = r.latency;
+  double ops_per_sec = r.seconds > 0 ? h.count() / r.seconds : 0;
+  if (FLAGS_format == "json") {
+    std::cout << "{\"key_bits\":" << c.key_bits << ",\"padding\":\""
+              << c.padding << "\",\"op\":\"" << c.op
+              << "\",\"threads\":" << c.threads << ",\"ops\":" << h.count()
+              << ",\"errors\":" << r.errors << ",\"seconds\":" << r.seconds
+              << ",\"ops_per_sec\":" << ops_per_sec
+              << ",\"mean_us\":" << h.mean()
+              << ",\"p50_us\":" << h.Percentile(0.5)
+              << ",\"p99_us\":" << h.Percentile(0.99)
+              << ",\"p999_us\":" << h.Percentile(0.999)
+              << ",\"max_us\":" << h.max() << "}" << std::endl;
+  } else {
+    std::cout << c.key_bits << "," << c.padding << "," << c.op << ","
+              << c.threads << "," << h.count() << "," << r.errors << ","
+              << r.seconds << "," << ops_per_sec << "," << h.mean() << ","
+              << h.Percentile(0.5) << "," << h.Percentile(0.99) << ","
+              << h.Percentile(0.999) << "," << h.max() << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  gflags::SetUsageMessage("Throughput and latency benchmark for rsa::Cryptor.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_format != "csv" && FLAGS_format != "json") {
+    std::cout << "Unknown format: " << FLAGS_format << std::endl;
+    return 1;
+  }
+  for (auto &padding : Split(FLAGS_paddings)) {
+    if (padding != "oaep" && padding != "v1_5") {
+      std::cout << "Unknown padding: " << padding << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<KeyPair> pairs;
+  if (!FLAGS_key_prefix.empty()) {
+    rsa::KeyStore key_store(1);
+    std::string fingerprint;
+    if (!key_store.Load(FLAGS_key_prefix, &fingerprint)) {
+      std::cout << key_store.last_error() << std::endl;
+      return 1;
+    }
+    pairs.push_back(
+        {key_store.GetPublic(fingerprint), key_store.GetPrivate(fingerprint)});
+  } else {
+    for (auto &s : Split(FLAGS_key_sizes)) {
+      KeyPair pair = GenerateKeyPair(std::stoi(s));
+      if (!pair.private_rsa || !pair.public_rsa) {
+        std::cout << "Failed to generate a " << s << "-bit key." << std::endl;
+        return 1;
+      }
+      pairs.push_back(pair);
+    }
+  }
+
+  if (FLAGS_format == "csv") {
+    std::cout << "key_bits,padding,op,threads,ops,errors,seconds,ops_per_sec,"
+                 "mean_us,p50_us,p99_us,p999_us,max_us"
+              << std::endl;
+  }
+  uint64_t errors = 0;
+  for (auto &pair : pairs) {
+    for (auto &padding : Split(FLAGS_paddings)) {
+      for (const char *op : {"encrypt", "decrypt"}) {
+        for (int threads : ThreadCounts()) {
+          Case c = {RSA_bits(pair.private_rsa.get()), padding, op, threads};
+          Result r = Run(pair, c);
+          Print(c, r);
+          errors += r.errors;
+        }
+      }
+    }
+  }
+  return errors == 0 ? 0 : 1;
+}